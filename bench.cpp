@@ -0,0 +1,714 @@
+#include "game.hpp"
+#include "gravity.hpp"
+#include "profile.hpp"
+#include "recorder.hpp"
+#include "render_list.hpp"
+#include "rng.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unordered_map>
+#include <vector>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+#define WORLD_SIZE 20
+
+static double seconds_since(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+//heap allocations so far, a PROFILE=1 build already replaces operator new for this
+#ifdef OSMOSIM_PROFILE
+static uint64_t AllocCount(void) { return profile_allocs(); }
+#else
+static atomic<uint64_t> alloc_count(0);
+//the whole set is replaced so every form of new and delete pairs up, all of it stays out of line
+//or gcc sees malloc() and free() inlined on either side and reports them as mismatched
+[[gnu::noinline]] void* operator new(size_t n, const nothrow_t&) noexcept {
+	alloc_count.fetch_add(1, memory_order_relaxed);
+	return malloc(n > 0 ? n : 1);
+}
+[[gnu::noinline]] void* operator new(size_t n) {
+	if (void* p = operator new(n, nothrow)) return p;
+	throw bad_alloc();
+}
+[[gnu::noinline]] void* operator new[](size_t n) { return operator new(n); }
+[[gnu::noinline]] void* operator new[](size_t n, const nothrow_t& t) noexcept { return operator new(n, t); }
+[[gnu::noinline]] void operator delete(void* p) noexcept { free(p); }
+[[gnu::noinline]] void operator delete[](void* p) noexcept { free(p); }
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept { free(p); }
+[[gnu::noinline]] void operator delete[](void* p, size_t) noexcept { free(p); }
+[[gnu::noinline]] void operator delete(void* p, const nothrow_t&) noexcept { free(p); }
+[[gnu::noinline]] void operator delete[](void* p, const nothrow_t&) noexcept { free(p); }
+static uint64_t AllocCount(void) { return alloc_count.load(memory_order_relaxed); }
+#endif
+
+//peak resident memory in KiB since the last ResetPeakMemory(), -1 where it isn't available
+static void ResetPeakMemory(void) {
+#ifdef __GLIBC__
+	malloc_trim(0); //hand memory freed by earlier runs back first
+#endif
+#ifdef __linux__
+	if (FILE* f = fopen("/proc/self/clear_refs", "w")) {
+		fputs("5", f);
+		fclose(f);
+	}
+#endif
+}
+static long PeakMemory(void) {
+	long kb = -1;
+#ifdef __linux__
+	if (FILE* f = fopen("/proc/self/status", "r")) {
+		char line[256];
+		while (fgets(line, sizeof(line), f))
+			if (sscanf(line, "VmHWM: %ld", &kb) == 1) break;
+		fclose(f);
+	}
+#endif
+	return kb;
+}
+
+static void usage(const char* name) {
+	fprintf(stderr,
+		"usage: %s <benchmark> [options]\n"
+		"benchmarks:\n"
+		"  gravity      Barnes-Hut accuracy and speed against the direct sum\n"
+		"  broadphase   full steps with the quadtree grid (tight and loose) against sweep and prune,\n"
+		"               then grid queries with boxes beyond its bounds\n"
+		"  simd         batch kernels at every simd level this CPU supports\n"
+		"  replay       records a run, then replays and seeks through the recording\n"
+		"  render       render list building at several zoom levels\n"
+		"  scaling      full steps per scenario, mote count and grid depth\n"
+		"  swept        fast motes shot through resting ones, at several step sizes with and without sweeping\n"
+		"  blocks       orbital energy error and cost of plain and block steps\n"
+		"  kepler       a crowded disc with a sparse halo, with and without coasting\n"
+		"  memory       memory held and heap allocations of a splitting disc as it runs, serial and threaded\n"
+		"options:\n"
+		"  -m <bodies>  amount of bodies, scaling sweeps powers of 10 up to it (default 20000, scaling 10000000)\n"
+		"  -n <steps>   steps per run, scaling runs fewer for big counts (default 100)\n"
+		"  -d <depth>   tree depth (default %d, scaling sweeps 4 to 8)\n"
+		"  -r <seed>    random seed\n"
+		"  -csv <file>  also write the results of scaling as CSV\n",
+		name, GRID_DEPTH);
+}
+
+struct bench_options {
+	int bodies;
+	int steps;
+	int depth; //0 for the default
+	uint64_t seed;
+	const char* csv;
+};
+
+//one heavy body in the middle and a ring of light ones around it
+static void MakeRing(int n, uint64_t seed, vector<float>& px, vector<float>& py, vector<float>& mass) {
+	px.assign(1, 0), py.assign(1, 0), mass.assign(1, 1.5 * 1.5);
+	for (int i = 1; i < n; i++) {
+		const rng_block b = rng_philox(seed, i, 0, RNG_SCATTER);
+		const float d = 3 + (WORLD_SIZE * 0.9 - 3) * rng_unit(b.v[0]);
+		const float q = 2*M_PI * rng_unit(b.v[1]);
+		const float r = 0.005 + 0.025 * rng_unit(b.v[2]);
+		px.push_back(cos(q) * d);
+		py.push_back(sin(q) * d);
+		mass.push_back(r * r);
+	}
+}
+
+static int BenchGravity(const bench_options& opt) {
+	vector<float> px, py, mass;
+	MakeRing(opt.bodies, opt.seed, px, py, mass);
+	const size_t n = px.size();
+	
+	vector<float> ax(n), ay(n);
+	auto start = chrono::steady_clock::now();
+	DirectGravity(px.data(), py.data(), mass.data(), n, GRAVITY_SOFTENING, ax.data(), ay.data());
+	const double direct = seconds_since(start);
+	
+	const int depth = opt.depth > 0 ? opt.depth : GRID_DEPTH;
+	printf("bodies %zu, depth %d\n", n, depth);
+	printf("%-8s %12s %10s %12s %12s %12s\n", "theta", "time [ms]", "speedup", "rms err", "median err", "p99 err");
+	printf("%-8s %12.2f %10.2f %12s %12s %12s\n", "direct", direct * 1e3, 1., "-", "-", "-");
+	
+	MassTree tree(AABB({-WORLD_SIZE,-WORLD_SIZE}, {WORLD_SIZE,WORLD_SIZE}), depth);
+	for (float theta : {0.2f, 0.3f, 0.5f, 0.7f, 1.0f}) {
+		start = chrono::steady_clock::now();
+		tree.Build(px.data(), py.data(), mass.data(), n);
+		vector<vec2> acc(n);
+		for (size_t i = 0; i < n; i++)
+			acc[i] = tree.Accel(i, px[i], py[i], theta, GRAVITY_SOFTENING);
+		const double t = seconds_since(start);
+		
+		//relative error, near cancellation this blows up so percentiles are shown
+		vector<double> err(n);
+		double sum = 0;
+		for (size_t i = 0; i < n; i++) {
+			const vec2 exact(ax[i], ay[i]);
+			err[i] = (acc[i] - exact).length() / exact.length();
+			sum += err[i] * err[i];
+		}
+		sort(err.begin(), err.end());
+		printf("%-8.2f %12.2f %10.2f %12.3e %12.3e %12.3e\n", theta, t * 1e3, direct / t,
+			sqrt(sum / n), err[n / 2], err[n * 99 / 100]);
+	}
+	return 0;
+}
+
+enum scenario {
+	SCENARIO_RING, //thin ring of similar motes around the attractor
+	SCENARIO_DISC, //motes spread evenly over the whole world
+	SCENARIO_GIANT, //one big mote in a disc of dust
+};
+
+//adds motes on circular orbits around the attractor of a fresh game
+template <typename G>
+static void Populate(G& g, scenario s, int n, uint64_t seed) {
+	const Mote a = *g.GetMote(g.GetAttractors().front());
+	const float mass = a.radius * a.radius;
+	for (int i = 0; i < n; i++) {
+		const rng_block b = rng_philox(seed, i, 0, RNG_SCATTER);
+		float d;
+		if (s == SCENARIO_RING) d = 8 + 2 * rng_unit(b.v[0]);
+		else if (s == SCENARIO_GIANT && i == 0) d = 10;
+		else d = a.radius * 2 + (WORLD_SIZE * 0.9 - a.radius * 2) * sqrtf(rng_unit(b.v[0]));
+		float r = 0.005 + 0.025 * rng_unit(b.v[2]);
+		if (s == SCENARIO_GIANT) r = i == 0 ? 1 : 0.002 + 0.004 * rng_unit(b.v[2]);
+		const float q = 2*M_PI * rng_unit(b.v[1]);
+		const vec2 dir(cos(q), sin(q));
+		Mote m(a.pos + dir * d, r);
+		m.vel = vec2(-dir.y, dir.x) * sqrtf(GRAVITY_CONSTANT * mass / d);
+		g.AddMote(m);
+	}
+}
+
+static void SetLooseness(Game& g, float l) { g.GetBroadPhase().SetLooseness(l); }
+static void SetLooseness(SapGame&, float) {}
+
+//milliseconds per step of one broad-phase
+template <typename G>
+static double TimeSteps(const bench_options& opt, scenario s, size_t& motes, float looseness = 1) {
+	debug_log log;
+	sim_params param(log);
+	G g(AABB({-WORLD_SIZE,-WORLD_SIZE}, {WORLD_SIZE,WORLD_SIZE}), opt.seed);
+	SetLooseness(g, looseness);
+	Populate(g, s, opt.bodies, opt.seed);
+	const auto start = chrono::steady_clock::now();
+	g.Step(param, 1. / 60, opt.steps);
+	motes = g.MoteCount();
+	return seconds_since(start) * 1e3 / opt.steps;
+}
+
+//one query per box on a bare grid while some of the boxes have flown off beyond its bounds
+static void BenchEscaped(const bench_options& opt) {
+	const AABB world({-WORLD_SIZE,-WORLD_SIZE}, {WORLD_SIZE,WORLD_SIZE});
+	printf("\n%-10s %14s %12s %10s\n", "escaped", "queries [ms]", "ids/query", "overflow");
+	for (float share : {0.f, 0.01f, 0.1f}) {
+		GridBroadPhase grid(world, opt.depth > 0 ? opt.depth : GRID_DEPTH);
+		SlotMap<AABB> boxes;
+		vector<Handle> handles;
+		for (int i = 0; i < opt.bodies; i++) {
+			const rng_block b = rng_philox(opt.seed, i, 0, RNG_SCATTER);
+			const bool escaped = rng_unit(b.v[3]) < share;
+			const float d = WORLD_SIZE * (escaped ? 1.5 + 1.5 * rng_unit(b.v[0]) : 0.9 * sqrtf(rng_unit(b.v[0])));
+			const float q = 2*M_PI * rng_unit(b.v[1]);
+			const AABB bb = Circle(vec2(cos(q), sin(q)) * d, 0.005 + 0.025 * rng_unit(b.v[2])).GetAABB();
+			handles.push_back(boxes.Insert(bb));
+			grid.Insert(handles.back(), bb);
+		}
+		size_t ids = 0;
+		const auto start = chrono::steady_clock::now();
+		for (Handle h : handles)
+			grid.GetInside(*boxes.Find(h), [&](Handle) { ids++; });
+		const double t = seconds_since(start);
+		printf("%8.0f %% %14.3f %12.2f %10zu\n", share * 100, t * 1e3, static_cast<double>(ids) / handles.size(),
+			grid.OverflowCount());
+	}
+}
+
+static int BenchBroadPhase(const bench_options& opt) {
+	printf("motes %d, %d steps\n", opt.bodies, opt.steps);
+	printf("%-10s %14s %14s %14s %8s   %s\n", "scenario", "grid [ms]", "loose [ms]", "sap [ms]", "winner",
+		"motes left (grid, loose, sap)");
+	const pair<scenario, const char*> scenarios[] = {{SCENARIO_RING, "ring"}, {SCENARIO_DISC, "disc"}};
+	for (const auto& [s, name] : scenarios) {
+		size_t grid_motes, loose_motes, sap_motes;
+		const double grid = TimeSteps<Game>(opt, s, grid_motes);
+		const double loose = TimeSteps<Game>(opt, s, loose_motes, 1.25);
+		const double sap = TimeSteps<SapGame>(opt, s, sap_motes);
+		//candidate order differs between them, so merges and the final counts can differ slightly
+		const char* winner = grid <= loose && grid <= sap ? "grid" : loose <= sap ? "loose" : "sap";
+		printf("%-10s %14.3f %14.3f %14.3f %8s   %zu, %zu, %zu\n", name, grid, loose, sap, winner,
+			grid_motes, loose_motes, sap_motes);
+	}
+	BenchEscaped(opt);
+	return 0;
+}
+
+//runs the batch kernels on a ring at every supported level and checks them against scalar
+static int BenchSimd(const bench_options& opt) {
+	vector<float> px, py, mass;
+	MakeRing(opt.bodies, opt.seed, px, py, mass);
+	const size_t n = px.size() - 1; //without the attractor
+	vector<float> radius(n);
+	for (size_t i = 0; i < n; i++) radius[i] = sqrtf(mass[i+1]);
+	const size_t window = 16; //candidates per overlap test, about what a crowded cell gives
+	const float dt = 1.f / 60;
+	
+	vector<float> ref_vx, ref_px;
+	float ref_rx = 0;
+	size_t ref_hits = 0;
+	const simd_level best = simd_detect();
+	printf("bodies %zu, %d runs, best level %s\n", n, opt.steps, simd_name(best));
+	printf("%-8s %12s %12s %12s %8s\n", "level", "pull [ms]", "integr [ms]", "overlap [ms]", "exact");
+	bool exact = true;
+	for (int l = SIMD_SCALAR; l <= best; l++) {
+		simd_select(static_cast<simd_level>(l));
+		vector<float> x(px.begin() + 1, px.end()), y(py.begin() + 1, py.end());
+		vector<float> vx(n, 0), vy(n, 0);
+		float rx = 0, ry = 0;
+		
+		auto start = chrono::steady_clock::now();
+		for (int s = 0; s < opt.steps; s++)
+			simd_pull(x.data(), y.data(), vx.data(), vy.data(), radius.data(), n, px[0], py[0], dt, rx, ry);
+		const double pull = seconds_since(start);
+		
+		start = chrono::steady_clock::now();
+		for (int s = 0; s < opt.steps; s++)
+			simd_integrate(x.data(), y.data(), vx.data(), vy.data(), n, dt);
+		const double integrate = seconds_since(start);
+		
+		size_t hits = 0;
+		start = chrono::steady_clock::now();
+		for (int s = 0; s < opt.steps; s++)
+			for (size_t i = 0; i + window < n; i++)
+				for (size_t k = 0; ; k++) {
+					k = simd_first_overlap(x[i], y[i], radius[i], &x[i+1], &y[i+1], &radius[i+1], k, window);
+					if (k == window) break;
+					hits++;
+				}
+		const double overlap = seconds_since(start);
+		
+		bool same = true;
+		if (l == SIMD_SCALAR) ref_vx = vx, ref_px = x, ref_rx = rx, ref_hits = hits;
+		else same = vx == ref_vx && x == ref_px && rx == ref_rx && hits == ref_hits;
+		exact &= same;
+		printf("%-8s %12.3f %12.3f %12.3f %8s\n", simd_name(static_cast<simd_level>(l)),
+			pull * 1000, integrate * 1000, overlap * 1000, same ? "yes" : "NO");
+	}
+	simd_select(best);
+	return exact ? 0 : 1;
+}
+
+//records a splitting disc, then compares replaying and seeking with simulating
+static int BenchReplay(const bench_options& opt) {
+	const char* path = "osmosim-bench.traj";
+	debug_log log;
+	sim_params param(log);
+	param.allow_splitting = true;
+	trajectory_header h;
+	h.keyframe_interval = max(opt.steps / 10, 1);
+	h.seed = opt.seed;
+	
+	Game g(AABB({-WORLD_SIZE,-WORLD_SIZE}, {WORLD_SIZE,WORLD_SIZE}), opt.seed);
+	Populate(g, SCENARIO_DISC, opt.bodies, opt.seed);
+	Recorder rec;
+	if (!rec.Open(path, h)) {
+		fprintf(stderr, "%s: could not create recording\n", path);
+		return 1;
+	}
+	rec.Capture(g.GetStep(), g.GetMotes());
+	g.SetRecorder(&rec);
+	auto start = chrono::steady_clock::now();
+	g.Step(param, 1. / 60, opt.steps);
+	const double simulate = seconds_since(start);
+	g.SetRecorder(nullptr);
+	rec.Close();
+	
+	Replayer play;
+	if (!play.Open(path)) {
+		fprintf(stderr, "%s: could not read the recording back\n", path);
+		return 1;
+	}
+	FILE* f = fopen(path, "rb");
+	fseek(f, 0, SEEK_END);
+	const long bytes = ftell(f);
+	fclose(f);
+	
+	start = chrono::steady_clock::now();
+	while (play.Next());
+	const double replay = seconds_since(start);
+	
+	//the last recorded step has to match the game within half a quantum
+	const MoteStore& motes = g.GetMotes();
+	float max_err = 0;
+	bool same = play.size() == motes.size() && play.Step() == g.GetStep();
+	unordered_map<uint64_t, uint32_t> by_id;
+	for (uint32_t i = 0; i < motes.size(); i++) by_id[motes.id[i]] = i;
+	for (size_t k = 0; same && k < play.size(); k++) {
+		const auto it = by_id.find(play.Id(k));
+		if (it == by_id.end()) {
+			same = false;
+			break;
+		}
+		const uint32_t i = it->second;
+		max_err = max(max_err, (play.Pos(k) - motes.Pos(i)).length());
+	}
+	
+	const int seeks = 20;
+	start = chrono::steady_clock::now();
+	for (int s = 0; s < seeks; s++)
+		play.Seek(play.FirstStep() + rng_philox(opt.seed, s, 0, RNG_SCATTER).v[0] % (opt.steps + 1));
+	const double seek = seconds_since(start) / seeks;
+	remove(path);
+	
+	printf("motes %d -> %zu, %d steps, keyframe every %u\n", opt.bodies, motes.size(), opt.steps, h.keyframe_interval);
+	printf("file:       %.1f MB, %.2f bytes per mote step\n", bytes / 1e6, bytes / double(opt.steps) / motes.size());
+	printf("simulate:   %.3f ms/step (recording)\n", simulate * 1e3 / opt.steps);
+	printf("replay:     %.3f ms/step, %.1fx faster\n", replay * 1e3 / opt.steps, simulate / replay);
+	printf("seek:       %.3f ms average\n", seek * 1e3);
+	printf("last step:  %s, max position error %g\n", same ? "matches" : "DIFFERS", max_err);
+	return same ? 0 : 1;
+}
+
+//render lists of a disc at several zoom levels, against fetching and sorting every visible mote
+static int BenchRender(const bench_options& opt) {
+	const int depth = opt.depth > 0 ? opt.depth : GRID_DEPTH;
+	Game g(AABB({-WORLD_SIZE,-WORLD_SIZE}, {WORLD_SIZE,WORLD_SIZE}), opt.seed, depth);
+	Populate(g, SCENARIO_DISC, opt.bodies, opt.seed);
+	const MoteStore& motes = g.GetMotes();
+	const int w = 1920, h = 1080;
+	const float fit = h / (2.f * WORLD_SIZE);
+	const pair<float, const char*> zooms[] = {{fit / 4, "far"}, {fit, "fit"}, {50, "default"}, {400, "close"}};
+	
+	printf("motes %d, grid depth %d, %dx%d view\n", opt.bodies, depth, w, h);
+	printf("%-8s %8s %12s %12s %9s %9s %11s\n", "zoom", "px/unit", "naive [ms]", "list [ms]", "motes", "splats", "aggregated");
+	render_list list;
+	vector<uint32_t> naive;
+	for (const auto& [zoom, name] : zooms) {
+		const Viewport view = {0, 0, zoom, w, h};
+		
+		auto start = chrono::steady_clock::now();
+		for (int r = 0; r < opt.steps; r++) {
+			naive.clear();
+			g.GetBroadPhase().GetInside(view.GetAABB(), [&](Handle h) { naive.push_back(motes.Find(h)); });
+			sort(naive.begin(), naive.end(), [&](uint32_t a, uint32_t b) { return motes.radius[a] < motes.radius[b]; });
+		}
+		const double t_naive = seconds_since(start) / opt.steps;
+		
+		start = chrono::steady_clock::now();
+		for (int r = 0; r < opt.steps; r++)
+			BuildRenderList(g, view, 1, render_options(), list);
+		const double t_list = seconds_since(start) / opt.steps;
+		
+		printf("%-8s %8.2f %12.3f %12.3f %9zu %9zu %11zu\n", name, zoom, t_naive * 1e3, t_list * 1e3,
+			list.motes, list.splats, list.aggregated);
+	}
+	return 0;
+}
+
+//small fast motes fired through a field of resting ones, without the attractor
+//the finest step is the reference, sweeping should keep bigger steps close to it
+static int BenchSwept(const bench_options& opt) {
+	const int targets = 100, shots = 300;
+	const float field = 9, speed = 30, flight = 0.5; //crosses the field in 0.3 s
+	printf("%d resting motes, %d shots at %g units/s\n", targets, shots, speed);
+	printf("%-10s %-6s %9s %10s %12s %10s\n", "dt", "swept", "steps", "time [ms]", "passed", "shot area");
+	for (int div : {3840, 240, 60, 15})
+		for (bool swept : {false, true}) {
+			if (div == 3840 && swept) continue;
+			debug_log log;
+			sim_params param(log);
+			param.swept = swept;
+			Game g(AABB({-WORLD_SIZE,-WORLD_SIZE}, {WORLD_SIZE,WORLD_SIZE}), opt.seed);
+			g.RemoveMote(g.GetAttractors().front());
+			for (int i = 0; i < targets; i++) {
+				const rng_block b = rng_philox(opt.seed, i, 0, RNG_SCATTER);
+				g.AddMote(Mote(vec2(field * rng_unit(b.v[0]), field * (rng_unit(b.v[1]) - 0.5)), 0.04));
+			}
+			for (int i = 0; i < shots; i++) {
+				const rng_block b = rng_philox(opt.seed, i, 1, RNG_SCATTER);
+				Mote m(vec2(-2 - rng_unit(b.v[0]), field * (rng_unit(b.v[1]) - 0.5)), 0.01);
+				m.vel = vec2(speed, 0);
+				g.AddMote(m);
+			}
+			const int steps = flight * div;
+			const auto start = chrono::steady_clock::now();
+			g.Step(param, 1. / div, steps);
+			const double t = seconds_since(start);
+			
+			//shots keep their speed unless they hit something
+			const MoteStore& motes = g.GetMotes();
+			int passed = 0;
+			double area = 0;
+			for (size_t i = 0; i < motes.size(); i++)
+				if (motes.vx[i] > speed * 0.5) {
+					passed++;
+					area += motes.radius[i] * motes.radius[i];
+				}
+			printf("1/%-8d %-6s %9d %10.2f %12d %9.1f%%\n", div, swept ? "yes" : "no", steps, t * 1e3, passed,
+				100 * area / (shots * 0.01 * 0.01));
+		}
+	return 0;
+}
+
+//a tenth of the motes start at the closest point of eccentric orbits near the attractor, the rest
+//circle further out. Orbital energy drifts with coarse steps, collisions are rare as motes are tiny
+//and motes that did collide are left out of the error
+static int BenchBlocks(const bench_options& opt) {
+	const float span = 4; //simulated seconds
+	const int n = opt.bodies;
+	printf("motes %d over %g s\n", n, span);
+	printf("%-8s %-7s %10s %14s %14s %14s\n", "dt", "levels", "time [ms]", "updates/s", "circular err", "eccentric err");
+	const pair<int, int> runs[] = {{480, 0}, {60, 0}, {15, 0}, {15, 2}, {15, 3}, {15, 5}};
+	for (auto [div, levels] : runs) {
+		debug_log log;
+		sim_params param(log);
+		param.block_levels = levels;
+		Game g(AABB({-WORLD_SIZE,-WORLD_SIZE}, {WORLD_SIZE,WORLD_SIZE}), opt.seed);
+		const Mote a = *g.GetMote(g.GetAttractors().front());
+		const float gm = GRAVITY_CONSTANT * a.radius * a.radius;
+		auto energy = [&](const Mote& m) {
+			const Mote a_now = *g.GetMote(g.GetAttractors().front());
+			const vec2 v = m.vel - a_now.vel;
+			return 0.5 * v.dot(v) - gm / (m.pos - a_now.pos).length();
+		};
+		
+		struct tracked { Handle h; float radius; double energy; bool eccentric; };
+		vector<tracked> track;
+		for (int i = 0; i < n; i++) {
+			const rng_block b = rng_philox(opt.seed, i, 0, RNG_SCATTER);
+			const bool eccentric = i % 10 == 0;
+			const float d = eccentric ? 2.5 + 1.5 * rng_unit(b.v[0]) : 4 + 14 * sqrtf(rng_unit(b.v[0]));
+			const float q = 2*M_PI * rng_unit(b.v[1]);
+			const vec2 dir(cos(q), sin(q));
+			Mote m(a.pos + dir * d, 0.002 + 0.004 * rng_unit(b.v[2]));
+			m.vel = vec2(-dir.y, dir.x) * sqrtf(gm / d * (eccentric ? 1.5 : 1)); //eccentricity 0.5
+			track.push_back({g.AddMote(m), m.radius, energy(m), eccentric});
+		}
+		
+		const int steps = span * div;
+		const uint64_t updates = g.GetMoteUpdates();
+		const auto start = chrono::steady_clock::now();
+		g.Step(param, 1. / div, steps);
+		const double t = seconds_since(start);
+		
+		vector<double> err[2];
+		for (const tracked& k : track) {
+			const optional<Mote> m = g.GetMote(k.h);
+			if (!m || m->radius != k.radius) continue;
+			err[k.eccentric].push_back(fabs((energy(*m) - k.energy) / k.energy));
+		}
+		for (vector<double>& e : err) sort(e.begin(), e.end());
+		auto median = [](const vector<double>& e) { return e.empty() ? 0. : e[e.size() / 2]; };
+		printf("1/%-6d %-7d %10.1f %14.0f %14.3e %14.3e\n", div, levels, t * 1e3, (g.GetMoteUpdates() - updates) / span,
+			median(err[0]), median(err[1]));
+	}
+	return 0;
+}
+
+//most motes crowd a disc around the attractor, the rest are spread thinly over a halo further out
+//halo motes that never collided are checked against the orbit they started on
+static int BenchKepler(const bench_options& opt) {
+	const float span = 4; //simulated seconds
+	const float dt = 1. / 60;
+	const int disc = opt.bodies / 20;
+	const int depth = opt.depth > 0 ? opt.depth : GRID_DEPTH;
+	printf("disc %d motes, grid depth %d, over %g s\n", disc, depth, span);
+	printf("%-6s %-7s %10s %14s %10s %14s\n", "halo", "kepler", "time [ms]", "tests/s", "coasting", "halo err");
+	for (int halo : {opt.bodies / 40, opt.bodies / 10, opt.bodies / 4, opt.bodies})
+		for (bool kepler : {false, true}) {
+			debug_log log;
+			sim_params param(log);
+			param.kepler = kepler;
+			Game g(AABB({-WORLD_SIZE,-WORLD_SIZE}, {WORLD_SIZE,WORLD_SIZE}), opt.seed, depth);
+			const Mote a = *g.GetMote(g.GetAttractors().front());
+			const float gm = GRAVITY_CONSTANT * a.radius * a.radius;
+			//the attractor absorbs motes of the disc, energies go with its current mass
+			auto energy = [&](const Mote& m) {
+				const Mote a_now = *g.GetMote(g.GetAttractors().front());
+				const vec2 v = m.vel - a_now.vel;
+				return 0.5 * v.dot(v) - GRAVITY_CONSTANT * a_now.radius * a_now.radius / (m.pos - a_now.pos).length();
+			};
+			
+			struct tracked { Handle h; float radius; double energy; };
+			vector<tracked> track;
+			for (int i = 0; i < disc + halo; i++) {
+				const rng_block b = rng_philox(opt.seed, i, 0, RNG_SCATTER);
+				const bool out = i < halo;
+				const float d = out ? 10 + 8 * sqrtf(rng_unit(b.v[0])) : 2.5 + 5.5 * sqrtf(rng_unit(b.v[0]));
+				const float q = 2*M_PI * rng_unit(b.v[1]);
+				const vec2 dir(cos(q), sin(q));
+				//small disc motes, so the disc doesn't outweigh the attractor
+				Mote m(a.pos + dir * d, out ? 0.005 + 0.025 * rng_unit(b.v[2]) : 0.002 + 0.008 * rng_unit(b.v[2]));
+				//a little off circular, so the orbits cross
+				m.vel = vec2(-dir.y, dir.x) * sqrtf(gm / d * (1 + 0.2 * rng_unit(b.v[3])));
+				const Handle h = g.AddMote(m);
+				if (out) track.push_back({h, m.radius, energy(m)});
+			}
+			
+			const int steps = span / dt;
+			const uint64_t updates = g.GetMoteUpdates();
+			const auto start = chrono::steady_clock::now();
+			g.Step(param, dt, steps);
+			const double t = seconds_since(start);
+			
+			vector<double> err;
+			for (const tracked& k : track) {
+				const optional<Mote> m = g.GetMote(k.h);
+				if (m && m->radius == k.radius) err.push_back(fabs((energy(*m) - k.energy) / k.energy));
+			}
+			sort(err.begin(), err.end());
+			printf("%-6d %-7s %10.1f %14.0f %10zu %14.3e\n", halo, kepler ? "yes" : "no", t * 1e3,
+				(g.GetMoteUpdates() - updates) / span, g.CoastingCount(), err.empty() ? 0. : err[err.size() / 2]);
+		}
+	return 0;
+}
+
+//ten rows of -n steps each, the memory held should level off and allocations drop to about none
+static int BenchMemory(const bench_options& opt) {
+	printf("%-7s %7s %8s %8s %10s %12s %11s %12s\n", "threads", "step", "motes", "peak", "held [MB]",
+		"motes unused", "grid unused", "allocs/step");
+	for (int threads : {1, 4}) {
+		debug_log log;
+		sim_params param(log);
+		param.allow_splitting = true;
+		param.threads = threads;
+		Game g(AABB({-WORLD_SIZE,-WORLD_SIZE}, {WORLD_SIZE,WORLD_SIZE}), opt.seed, opt.depth > 0 ? opt.depth : GRID_DEPTH);
+		Populate(g, SCENARIO_DISC, opt.bodies, opt.seed);
+		for (int row = 0; row < 10; row++) {
+			const uint64_t allocs = AllocCount();
+			g.Step(param, 1. / 60, opt.steps);
+			const double per_step = static_cast<double>(AllocCount() - allocs) / opt.steps;
+			const memory_stats m = g.GetMemoryStats();
+			printf("%-7d %7llu %8zu %8zu %10.2f %11.0f%% %10.0f%% %12.2f\n", threads,
+				static_cast<unsigned long long>(g.GetStep()), m.motes.live, m.motes.peak, m.Bytes() / 1e6,
+				m.motes.Fragmentation() * 100, m.broadphase.Fragmentation() * 100, per_step);
+		}
+	}
+	return 0;
+}
+
+//mote steps per scaling run, big counts run fewer steps to stay within it
+static constexpr double SCALING_BUDGET = 2e7;
+
+struct scaling_run {
+	int steps;
+	double seconds;
+	double mote_steps; //motes alive at the start of every timed step, summed
+	size_t motes_left;
+	uint64_t allocs;
+	long peak_kb;
+};
+
+static scaling_run RunScaling(int depth, scenario s, bool split, int n, int steps, uint64_t seed) {
+	debug_log log;
+	sim_params param(log);
+	param.allow_splitting = split;
+	scaling_run run = {steps, 0, 0, 0, 0, 0};
+	ResetPeakMemory();
+	{
+		Game g(AABB({-WORLD_SIZE,-WORLD_SIZE}, {WORLD_SIZE,WORLD_SIZE}), seed, depth);
+		Populate(g, s, n, seed);
+		g.Step(param, 1. / 60, 1); //untimed, sizes the per step buffers
+		const uint64_t allocs = AllocCount();
+		const auto start = chrono::steady_clock::now();
+		for (int k = 0; k < steps; k++) {
+			run.mote_steps += g.MoteCount();
+			g.Step(param, 1. / 60, 1);
+		}
+		run.seconds = seconds_since(start);
+		run.allocs = AllocCount() - allocs;
+		run.motes_left = g.MoteCount();
+	}
+	run.peak_kb = PeakMemory();
+	return run;
+}
+
+//every scenario with splitting off and on, at every depth and power of 10 from 1000 up to -m motes
+static int BenchScaling(const bench_options& opt) {
+	if (opt.depth > GRID_MAX_DEPTH) {
+		fprintf(stderr, "scaling: depth has to be at most %d\n", GRID_MAX_DEPTH);
+		return 1;
+	}
+	FILE* csv = nullptr;
+	if (opt.csv != nullptr) {
+		csv = fopen(opt.csv, "w");
+		if (csv == nullptr) {
+			fprintf(stderr, "%s: could not create file\n", opt.csv);
+			return 1;
+		}
+		fprintf(csv, "scenario,splitting,depth,motes,steps,ns_per_mote_step,ms_per_step,peak_rss_kb,allocs,motes_left\n");
+	}
+	vector<int> depths = {4, 5, 6, 7, 8};
+	if (opt.depth > 0) depths = {opt.depth};
+	
+	printf("seed %llu, at most %d steps and %g mote steps per run\n", static_cast<unsigned long long>(opt.seed),
+		opt.steps, SCALING_BUDGET);
+	printf("%-6s %5s %5s %9s %6s %14s %11s %10s %11s %10s\n", "scene", "split", "depth", "motes", "steps",
+		"ns/mote-step", "ms/step", "peak [MB]", "allocs/step", "motes left");
+	const pair<scenario, const char*> scenarios[] = {{SCENARIO_DISC, "disc"}, {SCENARIO_RING, "ring"}, {SCENARIO_GIANT, "giant"}};
+	for (const auto& [s, name] : scenarios)
+		for (bool split : {false, true})
+			for (int depth : depths)
+				for (int n = 1000; n <= opt.bodies; n *= 10) {
+					const int steps = clamp(static_cast<int>(SCALING_BUDGET / n), 1, max(opt.steps, 1));
+					const scaling_run r = RunScaling(depth, s, split, n, steps, opt.seed);
+					const double ns = r.seconds * 1e9 / r.mote_steps;
+					const double ms = r.seconds * 1e3 / r.steps;
+					printf("%-6s %5s %5d %9d %6d %14.1f %11.3f %10.1f %11.1f %10zu\n", name, split ? "yes" : "no",
+						depth, n, r.steps, ns, ms, r.peak_kb / 1024., static_cast<double>(r.allocs) / r.steps, r.motes_left);
+					fflush(stdout);
+					if (csv != nullptr)
+						fprintf(csv, "%s,%d,%d,%d,%d,%.3f,%.6f,%ld,%llu,%zu\n", name, split, depth, n, r.steps, ns, ms,
+							r.peak_kb, static_cast<unsigned long long>(r.allocs), r.motes_left);
+					if (n > INT32_MAX / 10) break;
+				}
+	if (csv != nullptr && fclose(csv) != 0) {
+		fprintf(stderr, "%s: writing failed\n", opt.csv);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	bench_options opt = {-1, 100, 0, 1, nullptr};
+	for (int i = 2; i < argc; i++) {
+		const bool has_val = i + 1 < argc;
+		if (!strcmp(argv[i], "-m") && has_val) opt.bodies = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-n") && has_val) opt.steps = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-d") && has_val) opt.depth = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-r") && has_val) opt.seed = strtoull(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "-csv") && has_val) opt.csv = argv[++i];
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (opt.bodies < 0) opt.bodies = strcmp(argv[1], "scaling") ? 20000 : 10000000;
+	
+	if (!strcmp(argv[1], "gravity")) return BenchGravity(opt);
+	if (!strcmp(argv[1], "broadphase")) return BenchBroadPhase(opt);
+	if (!strcmp(argv[1], "simd")) return BenchSimd(opt);
+	if (!strcmp(argv[1], "replay")) return BenchReplay(opt);
+	if (!strcmp(argv[1], "render")) return BenchRender(opt);
+	if (!strcmp(argv[1], "scaling")) return BenchScaling(opt);
+	if (!strcmp(argv[1], "swept")) return BenchSwept(opt);
+	if (!strcmp(argv[1], "blocks")) return BenchBlocks(opt);
+	if (!strcmp(argv[1], "kepler")) return BenchKepler(opt);
+	if (!strcmp(argv[1], "memory")) return BenchMemory(opt);
+	usage(argv[0]);
+	return 1;
+}
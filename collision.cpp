@@ -15,6 +15,33 @@ bool circle_circle_coll(const Circle& c1, const Circle& c2) {
 	return point_in_circle(c1.pos, Circle(c2.pos, c1 + c2));
 }
 
+//|p + d t| = r solved for the smaller t, with p and d relative to c2
+bool circle_circle_toi(const Circle& c1, const vec2& d1, const Circle& c2, const vec2& d2, float& t) {
+	const vec2 p = c1.pos - c2.pos;
+	const vec2 d = d1 - d2;
+	const float r = c1 + c2;
+	const float c = p.length2() - r * r;
+	if (c <= 0) { //touching from the start
+		t = 0;
+		return true;
+	}
+	const float a = d.length2();
+	const float b = p.dot(d);
+	if (b >= 0 || a == 0) return false; //not getting closer
+	const float disc = b * b - a * c;
+	if (disc < 0) return false;
+	t = (-b - sqrtf(disc)) / a;
+	return t <= 1;
+}
+
+float circle_circle_closest(const Circle& c1, const vec2& d1, const Circle& c2, const vec2& d2) {
+	const vec2 p = c1.pos - c2.pos;
+	const vec2 d = d1 - d2;
+	const float a = d.length2();
+	const float t = a > 0 ? std::clamp(-p.dot(d) / a, 0.f, 1.f) : 0;
+	return (p + d * t).length();
+}
+
 bool rect_rect_coll(const AABB& a, const AABB& b) {
 	return a.B.x > b.A.x && a.B.y > b.A.y && a.A.x < b.B.x && a.A.y < b.B.y;
 }
@@ -1,10 +1,13 @@
 #pragma once
 #include <vector>
 #include <array>
+#include <algorithm>
+#include <numeric>
 #include <unordered_map>
 #include <unordered_set>
 #include <iostream>
 #include "common.hpp"
+#include "slotmap.hpp"
 
 // Function naming priority
 // point, line, circle, rect, capsule
@@ -24,6 +27,11 @@ bool point_in_rect(const vec2& p, const AABB& bb);
 // bool line_capsule_coll(const Line& l, const Capsule& c);
 
 bool circle_circle_coll(const Circle& c1, const Circle& c2);
+//swept circles, c1 and c2 are at the start of a step and move in a straight line by d1 and d2 during it
+//t is the first moment (0 - 1) they touch, false if they stay apart the whole step
+bool circle_circle_toi(const Circle& c1, const vec2& d1, const Circle& c2, const vec2& d2, float& t);
+//smallest distance between their centers during the step
+float circle_circle_closest(const Circle& c1, const vec2& d1, const Circle& c2, const vec2& d2);
 // bool circle_rect_coll(const Circle& c, const AABB& bb);
 
 bool rect_rect_coll(const AABB& a, const AABB& b);
@@ -93,6 +101,9 @@ struct GridLocation {
 	GridLocation(AABB bb, int max_depth);
 	
 	bool IsInvalid(void) const;
+	bool operator==(const GridLocation& o) const {
+		return x == o.x && y == o.y && dx == o.dx && dy == o.dy && depth == o.depth;
+	}
 	GridLocation& LowerDepth(void);
 	//scales local 0,0 -> 1,1 AABB into global AABB given by space
 	AABB GetAABB(AABB space) const;
@@ -100,15 +111,89 @@ struct GridLocation {
 
 std::tuple<int,int,int,int> GetGridBounds(AABB bb, int depth);
 
-//implements an NxN grid over an AABB 
-template <typename key, int depth>
+//interleaves the bits of x (even bits) and y (odd bits), the 4 subcells of a cell are morton * 4 + 0..3
+inline uint32_t morton_encode(uint32_t x, uint32_t y) {
+	auto spread = [](uint32_t v) {
+		v &= 0xFFFF;
+		v = (v | v << 8) & 0x00FF00FF;
+		v = (v | v << 4) & 0x0F0F0F0F;
+		v = (v | v << 2) & 0x33333333;
+		v = (v | v << 1) & 0x55555555;
+		return v;
+	};
+	return spread(x) | spread(y) << 1;
+}
+
+//ids stored in a grid and how many of them the deepest level holds, see Grid::GetOccupancy()
+struct GridOccupancy {
+	size_t ids;
+	size_t deepest_ids;
+	size_t deepest_cells; //filled ones
+};
+
+//implements an NxN grid over an AABB
+//keys are handles (see slotmap.hpp), a key has to be removed before its slot is handed out again
+//the depth is chosen at runtime, up to max_depth
+//boxes that aren't fully inside the bounds go into an unbounded overflow instead, a sparse hash of
+//cells as big as the ones OVERFLOW_LEVEL levels down, queries look into it only near those boxes
+template <typename key, int max_depth>
 class Grid {
 public:
-	const AABB bounds;
+	static constexpr int MAX_DEPTH = max_depth;
+	static constexpr int OVERFLOW_LEVEL = 4;
+	//per level (sx, sy, ex, ey) range of cells, only the first GetDepth()+1 are used
+	using CellBounds = std::array<std::tuple<int,int,int,int>, max_depth+1>;
 	
 private:
-	std::array<std::vector<std::pair<std::unordered_set<key>, bool>>, depth+1> grid;
-	std::unordered_map<key, GridLocation> registry;
+	AABB bounds;
+	//an id inside a cell, corner says which of its (up to 2x2) cells this is
+	struct CellEntry {
+		key id;
+		uint8_t corner; //(x - loc.x) + 2 * (y - loc.y)
+	};
+	//a cell's ids are a block of 2^size_class entries in the shared entry pool
+	struct Cell {
+		uint32_t start;
+		uint32_t size;
+		int32_t size_class; //-1 while the cell has no block
+		uint32_t below; //ids in all of its subcells, counted like size
+	};
+	static constexpr int MIN_SIZE_CLASS = 2;
+	//where an id is stored, slot[corner] is its index inside that cell's id array
+	//ids in the overflow have an invalid loc and the range of overflow cells they cover instead
+	struct Entry {
+		GridLocation loc;
+		union {
+			uint32_t slot[4];
+			int32_t range[4]; //sx, sy, ex, ey
+		};
+	};
+	//an id in an overflow cell, (sx, sy) is the first cell of its range
+	struct OverflowEntry {
+		key id;
+		int32_t sx, sy;
+	};
+	
+	int depth;
+	std::array<std::vector<Cell>, max_depth+1> grid;
+	//the id arrays of all cells, a cell that outgrows its block moves to one twice as big and one
+	//that drops to a quarter of it to one half as big, freed blocks go on the free list of their
+	//size, so cells hand memory to each other instead of each keeping the most it ever held
+	std::vector<CellEntry> entries;
+	std::array<std::vector<uint32_t>, 32> free_blocks; //block starts per size class
+	//occupancy per level in morton order, a bit is set if the cell or any subcell holds ids
+	//every word covers an 8x8 block, so all of it fits in a few cache lines
+	std::array<std::vector<uint64_t>, max_depth+1> filled;
+	std::array<size_t, max_depth+1> level_ids; //ids whose location is on the level
+	HandleTable<Entry> registry;
+	float looseness; //size of a cell's region compared to the cell, see SetLooseness()
+	using OverflowMap = std::unordered_map<uint64_t, std::vector<OverflowEntry>>;
+	OverflowMap overflow; //by OverflowKey(), no empty cells
+	//emptied overflow cells, new ones are made from these so ids going in and out don't allocate
+	std::vector<typename OverflowMap::node_type> spare_cells;
+	size_t peak_ids; //most ids stored at once
+	size_t overflow_ids;
+	AABB overflow_bounds; //covers every box in the overflow, only shrinks once it is empty
 	
 	AABB within_bounds(AABB bb) const {
 		const vec2 delta = bounds.B - bounds.A;
@@ -116,40 +201,196 @@ private:
 	}
 	
 	void MarkEmpty(int x, int y, int d) {
-		//check subcells
-		if (d < depth) {
-			const int w = 2 << d;
-			for (int i = 2*y; i <= 2*y+1; i++)
-				for (int j = 2*x; j <= 2*x+1; j++)
-					if (grid[d+1][i*w+j].second == true)
-						return;
-		}
-		//free to mark this empty if it is
-		const int w = 1 << d;
-		const int o = y * w + x;
-		if (!grid[d][o].first.empty()) return;
-		grid[d][o].second = false;
-		// std::cout << "marking " << x << ", " << y << " | " << d << " as empty" << std::endl;
-		if (d <= 0) return;
-		MarkEmpty(x/2, y/2, d-1); //recursively iterate
+		uint32_t m = morton_encode(x, y);
+		do {
+			if (grid[d][y * (1 << d) + x].size != 0) return;
+			if (d < depth && ChildBits(m, d) != 0) return; //a subcell still holds ids
+			filled[d][m >> 6] &= ~(1ull << (m & 63));
+			x /= 2, y /= 2, m >>= 2;
+			d--;
+		} while (d >= 0);
 	}
 	
 	void MarkFilled(int x, int y, int d) {
+		uint32_t m = morton_encode(x, y);
 		do {
-			const int o = y * (1 << d) + x;
-			if (grid[d][o].second) return;
-			grid[d][o].second = true;
-			// std::cout << "marking " << x << ", " << y << " | " << d << " as filled" << std::endl;
-			x /= 2, y /= 2;
+			uint64_t& word = filled[d][m >> 6];
+			const uint64_t bit = 1ull << (m & 63);
+			if (word & bit) return;
+			word |= bit;
+			m >>= 2;
 			d--;
 		} while (d >= 0);
 	}
 	
+	//adds delta to the below count of every cell above (x, y, d)
+	void CountBelow(int x, int y, int d, int32_t delta) {
+		while (d > 0) {
+			x >>= 1, y >>= 1, d--;
+			grid[d][y * (1 << d) + x].below += delta;
+		}
+	}
+	
+	//occupancy of the 4 subcells of the cell with morton code m, a nibble of one word
+	uint32_t ChildBits(uint32_t m, int d) const {
+		const uint32_t c = m << 2;
+		return (filled[d+1][c >> 6] >> (c & 63)) & 0xF;
+	}
+	
+	//overflow cell coordinates, far away ones are clamped so they stay in range
+	std::array<int32_t, 4> OverflowRange(const AABB& bb) const {
+		const vec2 cell = (bounds.B - bounds.A) / (1 << OVERFLOW_LEVEL);
+		auto to_cell = [](float v) { return static_cast<int32_t>(std::floor(std::clamp(v, -1e9f, 1e9f))); };
+		const AABB c = (bb - bounds.A) / cell;
+		return {to_cell(c.A.x), to_cell(c.A.y), to_cell(c.B.x), to_cell(c.B.y)};
+	}
+	static uint64_t OverflowKey(int32_t x, int32_t y) {
+		return static_cast<uint32_t>(x) | static_cast<uint64_t>(static_cast<uint32_t>(y)) << 32;
+	}
+	
+	void GrowOverflowBounds(const AABB& bb) {
+		overflow_bounds.A = vec2(std::min(overflow_bounds.A.x, bb.A.x), std::min(overflow_bounds.A.y, bb.A.y));
+		overflow_bounds.B = vec2(std::max(overflow_bounds.B.x, bb.B.x), std::max(overflow_bounds.B.y, bb.B.y));
+	}
+	
+	//the overflow cell k, a spare one if it doesn't exist yet
+	std::vector<OverflowEntry>& OverflowCell(uint64_t k) {
+		const auto it = overflow.find(k);
+		if (it != overflow.end()) return it->second;
+		if (spare_cells.empty()) return overflow[k];
+		typename OverflowMap::node_type cell = std::move(spare_cells.back());
+		spare_cells.pop_back();
+		cell.key() = k;
+		return overflow.insert(std::move(cell)).position->second;
+	}
+	
+	//overflow cells are sorted by id
+	void LinkOverflow(const key id, Entry& e, const AABB& bb) {
+		const auto r = OverflowRange(bb);
+		std::copy(r.begin(), r.end(), e.range);
+		for (int32_t y = r[1]; y <= r[3]; y++)
+			for (int32_t x = r[0]; x <= r[2]; x++) {
+				std::vector<OverflowEntry>& ids = OverflowCell(OverflowKey(x, y));
+				const auto at = std::upper_bound(ids.begin(), ids.end(), id,
+					[](const key& k, const OverflowEntry& o) { return k < o.id; });
+				ids.insert(at, {id, r[0], r[1]});
+			}
+		if (overflow_ids++ == 0) overflow_bounds = bb;
+		GrowOverflowBounds(bb);
+	}
+	
+	void UnlinkOverflow(const key id, const Entry& e) {
+		for (int32_t y = e.range[1]; y <= e.range[3]; y++)
+			for (int32_t x = e.range[0]; x <= e.range[2]; x++) {
+				const auto it = overflow.find(OverflowKey(x, y));
+				std::vector<OverflowEntry>& ids = it->second;
+				ids.erase(std::lower_bound(ids.begin(), ids.end(), id,
+					[](const OverflowEntry& o, const key& k) { return o.id < k; }));
+				if (ids.empty()) spare_cells.push_back(overflow.extract(it));
+			}
+		overflow_ids--;
+	}
+	
+	//how far the ids of a level may stick out of their cells
+	vec2 Margin(int d) const {
+		return (bounds.B - bounds.A) * ((looseness - 1) * 0.5f / (1 << d));
+	}
+	
+	CellEntry* Ids(const Cell& c) { return entries.data() + c.start; }
+	const CellEntry* Ids(const Cell& c) const { return entries.data() + c.start; }
+	static uint32_t Capacity(const Cell& c) { return c.size_class < 0 ? 0 : 1u << c.size_class; }
+	
+	//a free block of 2^k entries, the pool only grows when none is left
+	uint32_t AllocBlock(int k) {
+		std::vector<uint32_t>& blocks = free_blocks[k];
+		if (!blocks.empty()) {
+			const uint32_t start = blocks.back();
+			blocks.pop_back();
+			return start;
+		}
+		const uint32_t start = entries.size();
+		entries.resize(start + (1u << k));
+		return start;
+	}
+	
+	void FreeBlock(Cell& c) {
+		if (c.size_class >= 0) free_blocks[c.size_class].push_back(c.start);
+		c.size_class = -1;
+	}
+	
+	//smallest size class holding n ids
+	static int BlockClass(uint32_t n) {
+		int k = MIN_SIZE_CLASS;
+		while ((1u << k) < n) k++;
+		return k;
+	}
+	
+	//moves the ids of c into a block of 2^k entries, their slots stay the same
+	void MoveBlock(Cell& c, int k) {
+		const uint32_t start = AllocBlock(k);
+		std::copy_n(entries.begin() + c.start, c.size, entries.begin() + start);
+		FreeBlock(c);
+		c.start = start, c.size_class = k;
+	}
+	
+	//adds id to the end of every cell of e.loc and records the slots
+	void Link(const key id, Entry& e) {
+		const GridLocation& loc = e.loc;
+		level_ids[loc.depth]++;
+		for (int y = loc.y; y <= loc.y + loc.dy; y++)
+			for (int x = loc.x; x <= loc.x + loc.dx; x++) {
+				const uint8_t corner = (x - loc.x) + 2 * (y - loc.y);
+				Cell& c = grid[loc.depth][y * (1 << loc.depth) + x];
+				if (c.size == Capacity(c)) MoveBlock(c, std::max(c.size_class + 1, MIN_SIZE_CLASS));
+				Ids(c)[c.size] = {id, corner};
+				e.slot[corner] = c.size++;
+				MarkFilled(x, y, loc.depth);
+				CountBelow(x, y, loc.depth, 1);
+			}
+	}
+	
+	//removes the id from every cell of e.loc or the overflow, the registry entry is kept
+	//the last id of a cell takes the freed slot, so only its slot changes
+	void Unlink(const key id, const Entry& e) {
+		const GridLocation& loc = e.loc;
+		if (loc.IsInvalid()) {
+			UnlinkOverflow(id, e);
+			return;
+		}
+		level_ids[loc.depth]--;
+		for (int y = loc.y; y <= loc.y + loc.dy; y++)
+			for (int x = loc.x; x <= loc.x + loc.dx; x++) {
+				const uint8_t corner = (x - loc.x) + 2 * (y - loc.y);
+				Cell& c = grid[loc.depth][y * (1 << loc.depth) + x];
+				const uint32_t slot = e.slot[corner];
+				CellEntry* ids = Ids(c);
+				const CellEntry last = ids[--c.size];
+				if (slot != c.size) {
+					ids[slot] = last;
+					registry.Find(last.id)->slot[last.corner] = slot;
+				}
+				CountBelow(x, y, loc.depth, -1);
+				if (c.size == 0) {
+					FreeBlock(c);
+					MarkEmpty(x, y, loc.depth);
+				} else if (c.size_class > MIN_SIZE_CLASS && c.size <= Capacity(c) / 4) {
+					MoveBlock(c, c.size_class - 1);
+				}
+			}
+	}
+	
 public:
 	bool isFilled(int x, int y, int d) const {
 		const int w = 1 << d;
 		if (x < 0 || y < 0 || d < 0 || x >= w || y >= w || d > depth) return false;
-		return grid[d][y * w + x].second;
+		const uint32_t m = morton_encode(x, y);
+		return (filled[d][m >> 6] >> (m & 63)) & 1;
+	}
+	
+	//bit (sx & 1) + 2 * (sy & 1) is set for every filled subcell (sx, sy) of the cell
+	uint32_t FilledChildren(int x, int y, int d) const {
+		if (d >= depth) return 0;
+		return ChildBits(morton_encode(x, y), d);
 	}
 	
 	AABB GetAABB(int x, int y, int d) const {
@@ -161,83 +402,359 @@ public:
 		return bb * (bounds.B - bounds.A) + bounds.A;
 	}
 	
-	Grid(AABB bb) : bounds(bb) {
-		for (int i = 0; i <= depth; i++) {
-			grid[i].resize(1 << (2*i));
-		}
+	Grid(AABB bb, int depth = max_depth, float looseness = 1)
+	: bounds(bb), depth(-1), looseness(looseness), peak_ids(0), overflow_ids(0), overflow_bounds() {
+		SetDepth(depth);
 	}
 	
+	const AABB& GetBounds(void) const { return bounds; }
+	
+	//empties the grid but keeps the entry pool's memory around
 	void Clear(void) {
 		registry.clear();
-		for (auto v : grid)
-			for (auto set : v) {
-				set.first.clear();
-				set.second = false;
+		for (auto& v : grid)
+			std::fill(v.begin(), v.end(), Cell{0, 0, -1, 0});
+		entries.clear();
+		for (auto& blocks : free_blocks)
+			blocks.clear();
+		for (auto& v : filled)
+			std::fill(v.begin(), v.end(), 0);
+		level_ids.fill(0);
+		while (!overflow.empty()) {
+			spare_cells.push_back(overflow.extract(overflow.begin()));
+			spare_cells.back().mapped().clear();
+		}
+		overflow_ids = 0;
+	}
+	
+	int GetDepth(void) const { return depth; }
+	//changes the amount of levels below the root (clamped to 0 - max_depth) and empties the grid,
+	//every id has to be inserted again, preferably with Build()
+	void SetDepth(int d) {
+		d = std::clamp(d, 0, max_depth);
+		for (int i = 0; i <= max_depth; i++) {
+			if (i <= d) {
+				grid[i].resize(1 << (2*i));
+				filled[i].resize(((1 << (2*i)) + 63) / 64);
+			} else {
+				std::vector<Cell>().swap(grid[i]);
+				std::vector<uint64_t>().swap(filled[i]);
 			}
+		}
+		depth = d;
+		Clear();
+	}
+	
+	//ids whose box isn't fully inside the bounds
+	size_t OverflowCount(void) const { return overflow_ids; }
+	
+	//live counts ids, the bytes held are those of the cells, the entry pool, the overflow and the
+	//registry, unused ones are free blocks and the unfilled ends of the others
+	pool_stats GetStats(void) const {
+		size_t bytes = registry.bytes() + VectorBytes(spare_cells) + VectorBytes(entries);
+		size_t used = registry.size() * HandleTable<Entry>::SLOT_BYTES;
+		for (const auto& blocks : free_blocks)
+			bytes += VectorBytes(blocks);
+		for (int d = 0; d <= depth; d++) {
+			bytes += VectorBytes(grid[d]) + VectorBytes(filled[d]);
+			used += grid[d].size() * sizeof(Cell) + filled[d].size() * sizeof(uint64_t);
+			for (const Cell& c : grid[d])
+				used += c.size * sizeof(CellEntry);
+		}
+		//hash nodes hold a key and an array each
+		const size_t node = sizeof(typename OverflowMap::value_type) + sizeof(void*);
+		bytes += overflow.bucket_count() * sizeof(void*);
+		for (const auto& [k, ids] : overflow) {
+			bytes += node + VectorBytes(ids);
+			used += node + ids.size() * sizeof(OverflowEntry);
+		}
+		for (const typename OverflowMap::node_type& cell : spare_cells)
+			bytes += node + VectorBytes(cell.mapped());
+		return {registry.size(), peak_ids, bytes, used};
+	}
+	
+	GridOccupancy GetOccupancy(void) const {
+		GridOccupancy o = {registry.size(), level_ids[depth], 0};
+		for (uint64_t w : filled[depth])
+			o.deepest_cells += __builtin_popcountll(w);
+		return o;
 	}
 	
 	GridLocation GetLocation(const key id) const {
-		auto it = registry.find(id);
-		if (it == registry.end()) return GridLocation();
-		return it->second;
+		const Entry* e = registry.Find(id);
+		return e != nullptr ? e->loc : GridLocation();
 	}
 	
 	//removes id from grid
 	void Remove(const key id) {
-		GridLocation loc = GetLocation(id);
-		if (loc.IsInvalid()) return;
-		registry.erase(id);
-		for (int y = loc.y; y <= loc.y + loc.dy; y++)
-			for (int x = loc.x; x <= loc.x + loc.dx; x++) {
-				const int o = y * (1 << loc.depth) + x;
-				grid[loc.depth][o].first.erase(id);
-				if (grid[loc.depth][o].first.empty())
-					MarkEmpty(x, y, loc.depth);
-			}
+		const Entry* e = registry.Find(id);
+		if (e == nullptr) return;
+		Unlink(id, *e);
+		registry.Erase(id);
 	}
 	
+	//GridLocation(within_bounds(bb), depth) written out on floats, every insert goes through it
 	GridLocation GetInsertLocation(const AABB& bb) const {
-		return GridLocation(within_bounds(bb), depth);
+		const float ax = (bb.A.x - bounds.A.x) / (bounds.B.x - bounds.A.x);
+		const float ay = (bb.A.y - bounds.A.y) / (bounds.B.y - bounds.A.y);
+		const float bx = (bb.B.x - bounds.A.x) / (bounds.B.x - bounds.A.x);
+		const float by = (bb.B.y - bounds.A.y) / (bounds.B.y - bounds.A.y);
+		if (!(ax >= 0 && bx <= 1 && ay >= 0 && by <= 1)) return GridLocation();
+		int d = std::min(depth, 15);
+		const int w = 1 << d;
+		auto cell = [w](float v) { return std::min(std::max(static_cast<int>(v * w), 0), w-1); };
+		int sx = cell(ax), sy = cell(ay), ex = cell(bx), ey = cell(by);
+		//lower depth until possible to encode
+		while ((ex - sx > 1 || ey - sy > 1) && d > 0) {
+			d--;
+			sx >>= 1, sy >>= 1, ex >>= 1, ey >>= 1;
+		}
+		return GridLocation(sx, sy, ex - sx, ey - sy, d);
 	}
 	
+	//loose quadtree, above 1 an id stays in its cells until its box leaves them enlarged this many
+	//times around their center, so slowly moving ids are hardly ever moved
+	//queries look that much further around the box, 2 at most doubles the cells they visit
+	void SetLooseness(float l) { looseness = std::max(l, 1.f); }
+	float GetLooseness(void) const { return looseness; }
+	
 	//if key exists, moves its bounding box
 	void Insert(const key id, const AABB& bb) {
-		GridLocation loc = GetInsertLocation(bb);
-		if (loc.IsInvalid()) loc = GridLocation(0,0,0,0,0);
-		Remove(id);
+		auto [it, inserted] = registry.TryEmplace(id);
+		Entry& e = *it;
+		if (inserted) peak_ids = std::max(peak_ids, registry.size());
+		const bool was_overflow = !inserted && e.loc.IsInvalid();
+		if (!inserted && !was_overflow && looseness > 1) {
+			const vec2 m = Margin(e.loc.depth);
+			const AABB region = e.loc.GetAABB(bounds);
+			if (bb.inside(AABB(region.A - m, region.B + m))) return; //still inside its loose cells
+		}
+		const GridLocation loc = GetInsertLocation(bb);
+		if (loc.IsInvalid()) {
+			if (was_overflow && std::equal(e.range, e.range + 4, OverflowRange(bb).begin())) {
+				GrowOverflowBounds(bb);
+				return;
+			}
+			if (!inserted) Unlink(id, e);
+			e.loc = GridLocation();
+			LinkOverflow(id, e, bb);
+			return;
+		}
+		if (!inserted) {
+			if (loc == e.loc) return;
+			Unlink(id, e);
+		}
 		//insert into grid
-		registry[id] = loc;
-		for (int y = loc.y; y <= loc.y + loc.dy; y++)
-			for (int x = loc.x; x <= loc.x + loc.dx; x++) {
-				const int o = y * (1 << loc.depth) + x;
-				grid[loc.depth][o].first.insert(id);
-				MarkFilled(x, y, loc.depth);
+		e.loc = loc;
+		Link(id, e);
+	}
+	
+	//replaces the contents with n unique ids, id_at(i) and box_at(i) give the i-th one
+	//same result as Clear() and n calls to Insert() in id order, but the ids are counted per cell
+	//first, so every block is cut from the pool once and the ids are only written into place
+	template <typename IdAt, typename BoxAt>
+	void Build(size_t n, IdAt&& id_at, BoxAt&& box_at) {
+		Clear();
+		//in id order, the registry fills front to back and the cells end up sorted, so queries start
+		//out walking forward through the ids
+		bool sorted = true;
+		size_t slots = 0;
+		for (size_t i = 0; i < n; i++) {
+			if (i > 0 && id_at(i) < id_at(i-1)) sorted = false;
+			slots = std::max<size_t>(slots, id_at(i).index + 1);
+		}
+		std::vector<uint32_t> order;
+		if (!sorted) {
+			order.resize(n);
+			std::iota(order.begin(), order.end(), 0);
+			std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return id_at(a) < id_at(b); });
+		}
+		auto at = [&](size_t k) { return sorted ? k : order[k]; };
+		registry.grow(slots);
+		
+		//locations go straight into the registry, ids are counted per cell
+		std::array<std::vector<uint32_t>, max_depth+1> count;
+		for (int d = 0; d <= depth; d++) count[d].assign(grid[d].size(), 0);
+		for (size_t k = 0; k < n; k++) {
+			const size_t i = at(k);
+			Entry& e = *registry.TryEmplace(id_at(i)).first;
+			const GridLocation loc = e.loc = GetInsertLocation(box_at(i));
+			if (loc.IsInvalid()) continue;
+			level_ids[loc.depth]++;
+			for (int y = loc.y; y <= loc.y + loc.dy; y++)
+				for (int x = loc.x; x <= loc.x + loc.dx; x++)
+					count[loc.depth][y * (1 << loc.depth) + x]++;
+		}
+		
+		//one block per filled cell, carved off the pool back to back after a single resize
+		size_t pool = 0;
+		for (int d = 0; d <= depth; d++)
+			for (uint32_t c : count[d])
+				if (c > 0) pool += size_t(1) << BlockClass(c);
+		entries.resize(pool);
+		uint32_t start = 0;
+		for (int d = 0; d <= depth; d++)
+			for (uint32_t c = 0; c < grid[d].size(); c++)
+				if (count[d][c] > 0) {
+					Cell& cell = grid[d][c];
+					cell.size_class = BlockClass(count[d][c]);
+					cell.start = start;
+					start += 1u << cell.size_class;
+					MarkFilled(c & ((1 << d) - 1), c >> d, d);
+				}
+		//subtree counts bottom up, every cell hands its own and its subcells' ids to its parent
+		for (int d = depth; d > 0; d--) {
+			const int w = 1 << d;
+			for (uint32_t c = 0; c < grid[d].size(); c++) {
+				const uint32_t ids = count[d][c] + grid[d][c].below;
+				if (ids > 0) grid[d-1][((c >> d) >> 1) * (w >> 1) + ((c & (w - 1)) >> 1)].below += ids;
+			}
+		}
+		
+		//the writes into the cells land all over the pool, so the cell a few ids ahead is fetched early
+		constexpr size_t PREFETCH = 16;
+		for (size_t k = 0; k < n; k++) {
+			if (k + PREFETCH < n) {
+				const GridLocation& ahead = registry.Find(id_at(at(k + PREFETCH)))->loc;
+				if (!ahead.IsInvalid()) {
+					const Cell& c = grid[ahead.depth][ahead.y * (1 << ahead.depth) + ahead.x];
+					__builtin_prefetch(entries.data() + c.start + c.size, 1);
+				}
+			}
+			const size_t i = at(k);
+			const key id = id_at(i);
+			Entry& e = *registry.Find(id);
+			const GridLocation& loc = e.loc;
+			if (loc.IsInvalid()) {
+				LinkOverflow(id, e, box_at(i));
+				continue;
+			}
+			for (int y = loc.y; y <= loc.y + loc.dy; y++)
+				for (int x = loc.x; x <= loc.x + loc.dx; x++) {
+					const uint8_t corner = (x - loc.x) + 2 * (y - loc.y);
+					Cell& c = grid[loc.depth][y * (1 << loc.depth) + x];
+					Ids(c)[c.size] = {id, corner};
+					e.slot[corner] = c.size++;
+				}
+		}
+		peak_ids = std::max(peak_ids, registry.size());
+	}
+	
+	//cell coordinates per level whose (loose) cells may hold ids overlapping bb
+	//the b of GetInside() and GetInCell()
+	CellBounds GetCellBounds(const AABB& bb) const {
+		CellBounds b;
+		if (looseness <= 1) {
+			const auto [sx, sy, ex, ey] = GetGridBounds(within_bounds(bb), depth);
+			for (int d = 0; d <= depth; d++) {
+				const int t = depth - d;
+				b[d] = {sx >> t, sy >> t, ex >> t, ey >> t};
 			}
+			return b;
+		}
+		for (int d = 0; d <= depth; d++) {
+			const vec2 m = Margin(d);
+			b[d] = GetGridBounds(within_bounds(AABB(bb.A - m, bb.B + m)), d);
+		}
+		return b;
+	}
+	
+	//amount of ids stored in the cell itself, ids spanning several cells count in each
+	size_t CountInCell(int x, int y, int d) const {
+		return grid[d][y * (1 << d) + x].size;
+	}
+	
+	//same for the cell and all of its subcells
+	size_t CountSubtree(int x, int y, int d) const {
+		const Cell& c = grid[d][y * (1 << d) + x];
+		return c.size + c.below;
+	}
+	
+	//calls visit(id) for the ids stored in the cell itself, not in its subcells
+	//ids spanning several cells are only reported from the first of them inside the grid bounds b
+	template <typename Visitor>
+	void GetInCell(const CellBounds& b, int x, int y, int d, Visitor&& visit) const {
+		const int bx = std::get<0>(b[d]);
+		const int by = std::get<1>(b[d]);
+		const Cell& c = grid[d][y * (1 << d) + x];
+		const CellEntry* ids = Ids(c);
+		for (uint32_t k = 0; k < c.size; k++) {
+			const CellEntry& e = ids[k];
+			if ((e.corner & 1) && x != bx) continue; //left neighbour is inside b too
+			if ((e.corner & 2) && y != by) continue; //same for the one above
+			visit(e.id);
+		}
 	}
 	
-	void GetInside(std::unordered_set<key>& found, const std::tuple<int,int,int,int>& b, int x, int y, int d) const {
-		const int o = y * (1 << d) + x;
-		if (grid[d][o].second == false) return;
-		for (key id : grid[d][o].first)
-			found.insert(id);
+	//calls visit(id) for every id inside the filled cells overlapping the grid bounds b
+	//ids spanning several cells are only reported from the first of them inside b
+	//the cell itself has to be filled
+	template <typename Visitor>
+	void GetInside(const CellBounds& b, int x, int y, int d, Visitor& visit) const {
+		GetInCell(b, x, y, d, visit);
 		if (d >= depth) return;
-		//check subnodes
-		const int t = depth - (d+1);
-		const int sx = std::max(std::get<0>(b) >> t, 2*x);
-		const int sy = std::max(std::get<1>(b) >> t, 2*y);
-		const int ex = std::min(std::get<2>(b) >> t, 2*x+1);
-		const int ey = std::min(std::get<3>(b) >> t, 2*y+1);
+		//check filled subnodes
+		const uint32_t children = ChildBits(morton_encode(x, y), d);
+		if (children == 0) return;
+		const auto [bsx, bsy, bex, bey] = b[d+1];
+		const int sx = std::max(bsx, 2*x);
+		const int sy = std::max(bsy, 2*y);
+		const int ex = std::min(bex, 2*x+1);
+		const int ey = std::min(bey, 2*y+1);
 		for (int i = sy; i <= ey; i++)
 			for (int j = sx; j <= ex; j++)
-				GetInside(found, b, j, i, d+1);
+				if (children >> ((j & 1) + 2 * (i & 1)) & 1)
+					GetInside(b, j, i, d+1, visit);
+	}
+	
+	//calls visit(id) once for every id in the overflow cells overlapping bb
+	template <typename Visitor>
+	void GetInOverflow(const AABB& bb, Visitor&& visit) const {
+		if (overflow_ids == 0) return;
+		//only the part of bb that can hold overflow boxes, keeps the cell range small
+		const AABB q(
+			{std::max(bb.A.x, overflow_bounds.A.x), std::max(bb.A.y, overflow_bounds.A.y)},
+			{std::min(bb.B.x, overflow_bounds.B.x), std::min(bb.B.y, overflow_bounds.B.y)}
+		);
+		if (q.A.x > q.B.x || q.A.y > q.B.y) return;
+		const auto [sx, sy, ex, ey] = OverflowRange(q);
+		auto visit_cell = [&](int32_t x, int32_t y, const std::vector<OverflowEntry>& ids) {
+			for (const OverflowEntry& o : ids)
+				if (std::max(o.sx, sx) == x && std::max(o.sy, sy) == y) //first of its cells inside the range
+					visit(o.id);
+		};
+		if ((static_cast<double>(ex) - sx + 1) * (static_cast<double>(ey) - sy + 1) > overflow.size()) {
+			for (const auto& [k, ids] : overflow) {
+				const int32_t x = static_cast<int32_t>(k), y = static_cast<int32_t>(k >> 32);
+				if (x >= sx && x <= ex && y >= sy && y <= ey) visit_cell(x, y, ids);
+			}
+			return;
+		}
+		for (int32_t y = sy; y <= ey; y++)
+			for (int32_t x = sx; x <= ex; x++) {
+				const auto it = overflow.find(OverflowKey(x, y));
+				if (it != overflow.end()) visit_cell(x, y, it->second);
+			}
+	}
+	
+	//calls visit(id) once for every id whose bounding box collides with given one
+	//the grid must not be modified from inside visit
+	template <typename Visitor>
+	void GetInside(const AABB& bb, Visitor&& visit) const {
+		const auto b = GetCellBounds(bb);
+		if (isFilled(0, 0, 0)) GetInside(b, 0, 0, 0, visit);
+		GetInOverflow(bb, visit);
+	}
+	
+	//appends ids whose bounding box collides with given one, each id is added once
+	void GetInside(const AABB& bb, std::vector<key>& found) const {
+		GetInside(bb, [&found](const key id) { found.push_back(id); });
 	}
 	
 	//returns list of ids whose bounding box collides with given one
 	std::unordered_set<key> GetInside(AABB bb) const {
 		std::unordered_set<key> found;
-		bb = within_bounds(bb);
-		const auto b = GetGridBounds(bb, depth);
-		GetInside(found, b, 0, 0, 0);
+		GetInside(bb, [&found](const key id) { found.insert(id); });
 		return found;
 	}
 };
@@ -31,7 +31,3 @@ struct vec2 {
 	float length2(void) const;
 };
 
-
-inline float rand_float(float a = 0, float b = 1) {
-	return a + static_cast<float>(rand()) / (static_cast<float>(RAND_MAX / (b-a)));
-}
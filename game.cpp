@@ -1,13 +1,19 @@
 #include "game.hpp"
 #include "collision.hpp"
 #include "common.hpp"
+#include "profile.hpp"
+#include "simd.hpp"
+#include "recorder.hpp"
+#include "snapshot.hpp"
 #include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <memory>
-#include <raylib.h>
+#include <type_traits>
 #include <cstdlib>
+#include <cstdarg>
+#include <cstring>
 #include <vector>
 
 
@@ -26,21 +32,6 @@ void debug_log::append(const char* format, ...) {
 }
 
 
-Texture2D tex[TEX_AMOUNT];
-float tex_scalars[TEX_AMOUNT];
-
-#define LOAD_TEX(file, en, scale) \
-	tex[en] = LoadTexture(file);\
-	SetTextureFilter(tex[en], TEXTURE_FILTER_BILINEAR);\
-	tex_scalars[en] = scale
-
-bool InitTextures(void) {
-	LOAD_TEX("Textures/spore.png", TEXTURE_AMBIENT, 1.37);
-	LOAD_TEX("Textures/spore3.png", TEXTURE_ATTRACTOR, 1.31);
-	return true;
-}
-
-
 AABB Viewport::GetAABB(void) const {
 	const float z = 0.5 / zoom;
 	return AABB(
@@ -57,76 +48,238 @@ std::pair<float, float> Viewport::ToScreen(float x, float y) const {
 }
 
 
-uint64_t Game::AddMote(MotePtr m) {
-	motes[next_id] = m;
-	grid.Insert(next_id, m->GetAABB());
-	if (m->IsAttractor()) attractors[next_id] = m;
-	return next_id++;
+template <typename BroadPhase>
+Handle BasicGame<BroadPhase>::AddMote(const Mote& m) {
+	uint32_t i = motes.Add(next_id, m);
+	//ahead of the coasting motes
+	motes.Swap(i, awake);
+	i = awake++;
+	motes.time_offset[i] = rng_float(seed, next_id, 0, RNG_TIME_OFFSET, 0, 256);
+	next_id++;
+	const Handle h = motes.handle[i];
+	broadphase.Insert(h, motes.GetAABB(i));
+	if (m.IsAttractor()) attractors.push_back(h);
+	return h;
 }
 
-MotePtr Game::GetMote(uint64_t id) const {
-	//get iterator of element
-	auto it = motes.find(id);
+template <typename BroadPhase>
+std::optional<Mote> BasicGame<BroadPhase>::GetMote(Handle h) const {
+	const int64_t i = motes.Find(h);
 	//mote does not exist
-	if (it == motes.end()) return nullptr;
+	if (i < 0) return std::nullopt;
 	
-	return it->second;
+	return motes.Get(i);
 }
 
-void Game::RemoveMote(uint64_t id) {
-	motes.erase(id);
-	grid.Remove(id);
-	attractors.erase(id);
+template <typename BroadPhase>
+bool BasicGame<BroadPhase>::SetMote(Handle h, const Mote& m) {
+	if (motes.Find(h) < 0) return false;
+	//the orbit is no longer the one it was on
+	Wake(h, step);
+	Regroup();
+	const int64_t i = motes.Find(h);
+	motes.Set(i, m);
+	backoff.Erase(h);
+	broadphase.Insert(h, motes.GetAABB(i));
+	return true;
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::RemoveMote(Handle h) {
+	const int64_t i = motes.Find(h);
+	if (i < 0 || motes.radius[i] < 0) return;
+	Wake(h, step);
+	Kill(i, commands);
+	ApplyCommands();
 	// std::cout << "Removed " << id << std::endl;
 }
 
-void RenderAABB(const Viewport& view, AABB bb) {
-	auto [Ax, Ay] = view.ToScreen(bb.A.x, bb.A.y);
-	auto [Bx, By] = view.ToScreen(bb.B.x, bb.B.y);
-	DrawRectangleLines(Ax, Ay, Bx - Ax, By - Ay, WHITE);
+template <typename BroadPhase>
+bool BasicGame<BroadPhase>::Save(const char* path) const {
+	snapshot_header h = {};
+	memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+	h.version = SNAPSHOT_VERSION;
+	h.header_size = sizeof(h);
+	h.motes = motes.size();
+	h.next_id = next_id;
+	h.seed = seed;
+	h.step = step;
+	h.bounds[0] = bounds.A.x, h.bounds[1] = bounds.A.y;
+	h.bounds[2] = bounds.B.x, h.bounds[3] = bounds.B.y;
+	h.total_area = total_area;
+	return WriteSnapshot(path, h, motes);
 }
 
-void RenderAABBFilled(const Viewport& view, AABB bb, Color clr) {
-	auto [Ax, Ay] = view.ToScreen(bb.A.x, bb.A.y);
-	auto [Bx, By] = view.ToScreen(bb.B.x, bb.B.y);
-	DrawRectangleV({Ax, Ay}, {Bx - Ax, By - Ay}, clr);
+//grids are built at the requested depth right away
+template <typename BroadPhase>
+static BroadPhase MakeBroadPhase(const AABB& bb, int grid_depth) {
+	if constexpr (std::is_same_v<BroadPhase, GridBroadPhase>) return BroadPhase(bb, grid_depth);
+	else return BroadPhase(bb);
 }
 
-void Game::RenderGridRecursive(const Viewport& view, int x, int y, int d) const {
-	if (!grid.isFilled(x, y, d)) return;
-	float inten = 1. - powf(1.3, -d);
-	Color clr = {static_cast<uint8_t>(inten * 255), 0, 0, 255};
-	RenderAABBFilled(view, grid.GetAABB(x, y, d), clr);
-	RenderGridRecursive(view, 2*x, 2*y, d+1);
-	RenderGridRecursive(view, 2*x+1, 2*y, d+1);
-	RenderGridRecursive(view, 2*x, 2*y+1, d+1);
-	RenderGridRecursive(view, 2*x+1, 2*y+1, d+1);
+template <typename BroadPhase>
+bool BasicGame<BroadPhase>::Load(const Snapshot& snap) {
+	if (!snap.IsOpen()) return false;
+	const AABB bb = snap.Bounds();
+	//a world of another size gets a fresh broad-phase and mass tree over its bounds, at our depth
+	if (bb.A.x != bounds.A.x || bb.A.y != bounds.A.y || bb.B.x != bounds.B.x || bb.B.y != bounds.B.y) {
+		bounds = bb;
+		if constexpr (std::is_same_v<BroadPhase, GridBroadPhase>) {
+			const float looseness = broadphase.GetLooseness();
+			broadphase = MakeBroadPhase<BroadPhase>(bb, broadphase.GetDepth());
+			broadphase.SetLooseness(looseness);
+		}
+		else broadphase = MakeBroadPhase<BroadPhase>(bb, GetGridDepth());
+		mass_tree = MassTree(bb, mass_tree.GetDepth());
+	}
+	
+	const snapshot_header& h = snap.Header();
+	const size_t n = snap.Motes();
+	auto column = [&](std::vector<float>& v, snapshot_column c) {
+		const float* src = snap.Floats(c);
+		v.assign(src, src + n);
+	};
+	column(motes.px, SNAP_PX);
+	column(motes.py, SNAP_PY);
+	column(motes.vx, SNAP_VX);
+	column(motes.vy, SNAP_VY);
+	column(motes.radius, SNAP_RADIUS);
+	column(motes.time_offset, SNAP_TIME_OFFSET);
+	column(motes.split_cooldown, SNAP_SPLIT_COOLDOWN);
+	motes.type.assign(snap.Types(), snap.Types() + n);
+	motes.id.assign(snap.Ids(), snap.Ids() + n);
+	motes.Reindex();
+	
+	next_id = h.next_id;
+	seed = h.seed;
+	step = h.step;
+	total_area = h.total_area;
+	
+	broadphase.Build(n, [&](size_t i) { return motes.handle[i]; }, [&](size_t i) { return motes.GetAABB(i); });
+	//nothing about the previous world carries over, handles from before it stay stale under the new generations
+	commands.clear();
+	for (Commands& c : chunk_commands) c.clear();
+	level.clear();
+	approach.clear();
+	awake = n;
+	coast.clear();
+	for (std::vector<Handle>& due : coast_due) due.clear();
+	regroup.clear();
+	backoff.clear();
+	time = 0;
+	mote_updates = 0;
+	//attractors in id order, same as AddMote() would have added them
+	std::vector<uint32_t> found;
+	for (uint32_t i = 0; i < n; i++)
+		if (IsAttractor(motes.type[i])) found.push_back(i);
+	std::sort(found.begin(), found.end(), [&](uint32_t a, uint32_t b) { return motes.id[a] < motes.id[b]; });
+	attractors.clear();
+	for (uint32_t i : found) attractors.push_back(motes.handle[i]);
+	return true;
 }
 
-float total_area = 0;
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::SetGridDepth(int d) {
+	if constexpr (std::is_same_v<BroadPhase, GridBroadPhase>) {
+		d = std::clamp(d, 0, GridBroadPhase::MAX_DEPTH);
+		if (d == broadphase.GetDepth()) return;
+		broadphase.SetDepth(d);
+		mass_tree.SetDepth(d); //Barnes-Hut leaves as fine as the grid's cells
+		broadphase.Build(motes.size(), [&](size_t i) { return motes.handle[i]; }, [&](size_t i) { return motes.GetAABB(i); });
+		//coasting motes keep the boxes of their paths
+		for (uint32_t i = awake; i < motes.size(); i++)
+			if (const coast_state* c = coast.Find(motes.handle[i])) broadphase.Insert(motes.handle[i], c->box);
+	}
+}
 
-bool sort_motes(const std::pair<Mote*, uint64_t>& a, const std::pair<Mote*, uint64_t>& b) {
-	return a.first->radius < b.first->radius;
+template <typename BroadPhase>
+int BasicGame<BroadPhase>::GetGridDepth(void) const {
+	if constexpr (std::is_same_v<BroadPhase, GridBroadPhase>) return broadphase.GetDepth();
+	else return -1;
 }
 
-void Game::Render(const Viewport& view, sim_params& param, const float time) const {
-	//get camera's bounding box
-	const AABB bb = view.GetAABB();
-	//get motes
-	std::unordered_set<uint64_t> visible = grid.GetInside(bb);
-	std::vector<std::pair<Mote*, uint64_t>> m;
-	for (uint64_t id : visible) m.push_back({GetMote(id).get(), id});
-	std::sort(m.begin(), m.end(), sort_motes);
+template <typename BroadPhase>
+memory_stats BasicGame<BroadPhase>::GetMemoryStats(void) const {
+	memory_stats m = {motes.GetStats(), {0, 0, 0, 0}, 0};
+	if constexpr (std::is_same_v<BroadPhase, GridBroadPhase>) m.broadphase = broadphase.GetStats();
 	
-	//render grid
-	if (param.show_grid) RenderGridRecursive(view, 0, 0, 0);
-	
-	for (const auto& r : m) {
-		if (param.show_grid_colliders) RenderAABB(view, grid.GetLocation(r.second).GetAABB(bounds));
-		r.first->Render(view, param, time);
+	auto candidate_bytes = [](const Candidates& c) {
+		return VectorBytes(c.index) + VectorBytes(c.x) + VectorBytes(c.y) + VectorBytes(c.r);
+	};
+	auto command_bytes = [](const Commands& c) { return VectorBytes(c.spawn) + VectorBytes(c.kill); };
+	size_t& n = m.scratch;
+	n = candidate_bytes(candidates) + command_bytes(commands) + mass_tree.Bytes() + VectorBytes(mass);
+	n += VectorBytes(start_x) + VectorBytes(start_y);
+	n += VectorBytes(level) + VectorBytes(level_motes) + VectorBytes(drifted) + approach.bytes() + VectorBytes(pull_terms);
+	for (const std::vector<uint32_t>& l : level_motes) n += VectorBytes(l);
+	n += coast.bytes() + VectorBytes(regroup) + backoff.bytes();
+	for (const std::vector<Handle>& due : coast_due) n += VectorBytes(due);
+	n += VectorBytes(chunk_reaction) + VectorBytes(chunk_pairs) + VectorBytes(chunk_candidates) + VectorBytes(chunk_commands);
+	for (const auto& p : chunk_pairs) n += VectorBytes(p);
+	for (const Candidates& c : chunk_candidates) n += candidate_bytes(c);
+	for (const Commands& c : chunk_commands) n += command_bytes(c);
+	n += VectorBytes(pairs) + VectorBytes(island_parent) + VectorBytes(island_id) + VectorBytes(island_start);
+	n += VectorBytes(island_fill) + VectorBytes(island_pairs) + VectorBytes(pair_island) + VectorBytes(touched);
+	n += VectorBytes(split_roll);
+	return m;
+}
+
+//a level deeper splits each cell in 4, so from crowded (over 8 ids) it lands at about 2 and from
+//nearly single ids (under 1.5) a level up lands under 8 again, the depth doesn't flip back and forth
+//going deeper only helps if most ids are small enough for the deepest level and queries are costly
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::TuneGridDepth(void) {
+	uint64_t queries = candidates.queries, scanned = candidates.scanned;
+	candidates.queries = candidates.scanned = 0;
+	for (Candidates& c : chunk_candidates) {
+		queries += c.queries, scanned += c.scanned;
+		c.queries = c.scanned = 0;
+	}
+	if constexpr (std::is_same_v<BroadPhase, GridBroadPhase>) {
+		const GridOccupancy o = broadphase.GetOccupancy();
+		if (queries == 0 || o.deepest_cells == 0) return;
+		const double occupancy = static_cast<double>(o.deepest_ids) / o.deepest_cells;
+		const double cost = static_cast<double>(scanned) / queries;
+		const int d = broadphase.GetDepth();
+		if (occupancy > 8 && cost > 8 && o.deepest_ids * 2 >= o.ids) SetGridDepth(d + 1);
+		else if (occupancy < 1.5) SetGridDepth(d - 1);
 	}
 }
 
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::Kill(uint32_t i, Commands& cmd) {
+	motes.radius[i] = -1;
+	cmd.kill.push_back(i);
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::ApplyCommands(void) {
+	for (uint32_t i : commands.kill) {
+		const Handle h = motes.handle[i];
+		broadphase.Remove(h);
+		if (IsAttractor(motes.type[i]))
+			attractors.erase(std::find(attractors.begin(), attractors.end(), h));
+	}
+	//one sweep frees every dead slot, a dead mote ahead of the coasting ones first trades places with
+	//the last of them
+	if (!commands.kill.empty())
+		for (uint32_t i = 0; i < motes.size();) {
+			if (motes.radius[i] >= 0) {
+				i++;
+				continue;
+			}
+			if (i < awake) {
+				motes.Swap(i, --awake);
+				motes.Remove(awake);
+			}
+			else motes.Remove(i);
+		}
+	for (const Mote& m : commands.spawn)
+		AddMote(m);
+	commands.clear();
+	Regroup();
+}
+
 // bool Game::CheckSurface(const MotePtr m, vec2& norm, float& dist) {
 // 	int x = 0, y = 0;
 // 	float dx = 0, dy = 0;
@@ -144,105 +297,263 @@ void Game::Render(const Viewport& view, sim_params& param, const float time) con
 // 	}
 // 	return false;
 // }
-bool Game::CheckSurface(const MotePtr m, vec2& norm, float& dist) {
+template <typename BroadPhase>
+bool BasicGame<BroadPhase>::CheckSurface(uint32_t i, vec2& norm, float& dist) const {
 	const float r = std::min(bounds.B.x, bounds.B.y);
-	const float len = m->pos.length();
-	const float d = len + m->radius - r;
+	const vec2 pos = motes.Pos(i);
+	const float len = pos.length();
+	const float d = len + motes.radius[i] - r;
 	if (d > 0) {
-		norm = -m->pos / len;
+		norm = -pos / len;
 		dist = d;
 		return true;
 	}
 	return false;
 }
 
-void Game::Update(const sim_params& param, const float& dt) {
-	std::vector<uint64_t> mote_list;
-	mote_list.reserve(motes.size());
-	for (const auto& [id, m] : motes)
-		mote_list.push_back(id);
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::Update(const sim_params& param, const float& dt) {
+	sweep = param.swept && param.block_levels <= 0;
+	coast_on = CanCoast(param);
+	//the wakes and split rolls were counted for the steps as they were
+	if (coast.size() > 0 && (!coast_on || attractors.front() != track.attractor || dt != track.dt ||
+		param.allow_splitting != track.splitting))
+		WakeAll();
+	time += dt;
+	if (param.block_levels <= 0) mote_updates += motes.size();
+	if (param.block_levels > 0) UpdateBlocks(param, dt);
+	else if (param.threads > 1) UpdateParallel(param, dt);
+	else UpdateSerial(param, dt);
+	step++;
+	if (param.auto_depth && step % GRID_TUNE_INTERVAL == 0) TuneGridDepth();
+	if (recorder != nullptr) {
+		PlaceCoasting();
+		recorder->Capture(step, motes);
+	}
 	
-	for (size_t i = 0; i < mote_list.size(); i++) {
-		const uint64_t id = mote_list[i];
-		const MotePtr m = GetMote(id);
-		if (m == nullptr) continue;
-		
-		for (const auto& [a_id, a] : attractors)
-			if (id != a_id)
-				m->AttractTowards(a, dt);
+	{
+		PROFILE_SCOPE(PROF_AREA);
+		total_area = 0;
+		const float* r = motes.radius.data();
+		for (size_t i = 0; i < motes.size(); i++)
+			total_area += r[i] * r[i];
+	}
+	PROFILE_END_STEP(step);
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::Step(const sim_params& param, const float& dt, int steps, bool keep_previous) {
+	for (int s = 0; s < steps; s++) {
+		if (keep_previous && s == steps - 1) {
+			PlaceCoasting();
+			motes.SavePositions();
+		}
+		Update(param, dt);
+	}
+	PlaceCoasting();
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::UpdateSerial(const sim_params& param, const float& dt) {
+	//streaming passes over every mote that doesn't coast
+	{
+		PROFILE_SCOPE(PROF_ATTRACT);
+		if (param.nbody_gravity) AttractAll(dt, param.bh_theta, nullptr, motes.size());
+		else Attract(dt, nullptr, motes.size());
+	}
+	{
+		PROFILE_SCOPE(PROF_INTEGRATE);
+		Integrate(dt, nullptr, motes.size());
+	}
+	if (coast_on) {
+		PROFILE_SCOPE(PROF_COAST);
+		UpdateCoasting();
+		mote_updates -= motes.size() - awake; //not tested this step
+	}
+	
+	//split children and absorbed motes are only added and removed after the loop, the rows of
+	//motes that start or stop coasting only move then too
+	const uint32_t n = awake;
+	PROFILE_LAPS(laps);
+	for (uint32_t i = 0; i < n; i++) {
+		if (motes.radius[i] < 0) continue; //absorbed earlier this step
+		const Handle h = motes.handle[i];
 		
-		const MoteAction act = m->Update(param, dt);
 		vec2 norm;
 		float dist;
-		if (CheckSurface(m, norm, dist))
-			m->CollideSurface(norm, dist);
+		if (CheckSurface(i, norm, dist))
+			CollideSurface(i, norm, dist);
+		PROFILE_LAP(laps, PROF_SURFACE);
 		
 		//evaluate actions
-		if (act.IsSplitting()) {
-			const float a = m->radius * m->radius;
-			const float r1 = sqrtf(a * (1 - act.split_amount));
-			const float r2 = sqrtf(a * act.split_amount);
-			
-			if (r2 > MIN_RADIUS) {
-				Mote new_m(m->pos + act.split_dir * (r1 + r2), r2);
-				m->radius = r1;
-				
-				//calculate velocities
-				new_m.vel = m->vel + act.split_dir * SPLIT_VELOCITY;
-				m->vel -= act.split_dir * SPLIT_VELOCITY * (act.split_amount / (1 - act.split_amount));
-				
-				MotePtr nm = std::make_shared<Mote>(new_m);
-				mote_list.push_back(AddMote(nm));
-			}
-		}
+		const MoteAction act = UpdateSplit(i, param, dt, param.allow_splitting ? SplitRoll(i) : 1);
+		if (act.IsSplitting()) Split(i, act, commands);
+		PROFILE_LAP(laps, PROF_SPLIT);
 		
-		//check for collisions
-		std::unordered_set<uint64_t> coll = grid.GetInside(m->GetAABB());
-		for (uint64_t other : coll) {
-			if (other == id) continue;
-			if (m->radius <= 0) break;
-			MotePtr mo = GetMote(other);
-			if (circle_circle_coll(m->GetCircle(), mo->GetCircle())) {
-				m->CollideMote(mo.get());
-				if (mo->radius <= 0) {
-					RemoveMote(other);
-				}
+		//check for collisions, a hit changes the radius of mote i so the test resumes after it
+		GatherCandidates(i, false, candidates);
+		//coasting candidates are put on their orbits, they haven't moved since they were last looked at
+		for (size_t k = 0; k < candidates.size(); k++) {
+			const uint32_t j = candidates.index[k];
+			if (j < n) continue;
+			Place(j);
+			candidates.x[k] = motes.px[j];
+			candidates.y[k] = motes.py[j];
+			candidates.r[k] = motes.radius[j];
+			if (sweep) start_x[j] = motes.px[j], start_y[j] = motes.py[j];
+		}
+		PROFILE_LAP(laps, PROF_BROADPHASE);
+		Circle ci = motes.GetCircle(i);
+		const float travel = Travel(i);
+		for (size_t k = 0; ci.r > 0; k++) {
+			k = simd_first_overlap(ci.pos.x, ci.pos.y, ci.r + travel, candidates.x.data(), candidates.y.data(),
+				candidates.r.data(), k, candidates.size());
+			if (k == candidates.size()) break;
+			const uint32_t j = candidates.index[k];
+			float d;
+			if (!sweep) d = (ci.pos - motes.Pos(j)).length();
+			else if (!Touching(i, j, d)) continue; //within reach but never touched
+			//before the hit changes its velocity, a no-op unless it was coasting
+			if (coast.size() > 0) Wake(motes.handle[j], step + 1);
+			CollideMotes(i, j, d);
+			if (motes.radius[j] <= 0) {
+				Kill(j, commands);
 			}
+			ci.r = motes.radius[i];
 		}
-		if (m->radius < MIN_RADIUS) {
-			RemoveMote(id);
+		PROFILE_LAP(laps, PROF_NARROWPHASE);
+		if (motes.radius[i] < MIN_RADIUS) {
+			Kill(i, commands);
 			continue;
 		}
-		grid.Insert(id, m->GetAABB());
+		broadphase.Insert(h, MoteBox(i));
+		PROFILE_LAP(laps, PROF_REINSERT);
+		
+		//nothing shares a cell with the mote, see if its path stays that clear
+		if (coast_on && candidates.size() == 0 && CoastDue(h))
+			TryCoast(i, dt, param);
+		PROFILE_LAP(laps, PROF_COAST);
 	}
+	PROFILE_SCOPE(PROF_COMMANDS);
+	ApplyCommands();
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::Split(uint32_t i, const MoteAction& act, Commands& cmd) {
+	const float a = motes.radius[i] * motes.radius[i];
+	const float r1 = sqrtf(a * (1 - act.split_amount));
+	const float r2 = sqrtf(a * act.split_amount);
 	
-	total_area = 0;
-	for (const auto& [id, m] : motes)
-		total_area += m->radius * m->radius;
+	if (r2 > MIN_RADIUS) {
+		Mote new_m(motes.Pos(i) + act.split_dir * (r1 + r2), r2);
+		motes.radius[i] = r1;
+		
+		//calculate velocities
+		new_m.vel = motes.Vel(i) + act.split_dir * SPLIT_VELOCITY;
+		motes.SetVel(i, motes.Vel(i) - act.split_dir * SPLIT_VELOCITY * (act.split_amount / (1 - act.split_amount)));
+		
+		cmd.spawn.push_back(new_m);
+	}
 }
 
-Game::Game(const AABB bb) : next_id(1), grid(bb), bounds(bb) {
+template <typename BroadPhase>
+BasicGame<BroadPhase>::BasicGame(const AABB bb, uint64_t seed, int grid_depth)
+: broadphase(MakeBroadPhase<BroadPhase>(bb, grid_depth)), next_id(1), seed(seed), step(0), total_area(0), mass_tree(bb, std::clamp(grid_depth, 0, GRID_MAX_DEPTH)),
+  sweep(false), mote_updates(0), awake(0), coast_on(false), time(0), recorder(nullptr),
+  bounds(bb) {
 	AttractorMote m(vec2(0, 0), 1.5);
 	m.vel = {0,0};
-	uint64_t m_id = AddMote(std::make_shared<AttractorMote>(m));
+	AddMote(m);
 }
 
 
 // Mote functions
 
-MoteAction Mote::Update(const sim_params& param, const float& dt) {
-	MoteAction act;
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::Attract(const float& dt, ThreadPool* pool, size_t chunk) {
+	const float gravity = GRAVITY_CONSTANT * dt;
+	const size_t n = awake;
+	if (n == 0) return;
+	const float* px = motes.px.data();
+	const float* py = motes.py.data();
+	const float* radius = motes.radius.data();
+	float* vx = motes.vx.data();
+	float* vy = motes.vy.data();
 	
-	pos += vel * dt;
+	for (Handle ah : attractors) {
+		const size_t a = motes.Find(ah);
+		const float am = radius[a] * radius[a] * gravity;
+		//reactions are summed per chunk and then in chunk order
+		chunk_reaction.assign((n + chunk - 1) / chunk, vec2(0));
+		ParallelFor(pool, n, chunk, [&](size_t begin, size_t end, size_t c) {
+			float rx = 0, ry = 0;
+			//the attractor itself splits the chunk in two
+			const size_t mid = std::min(std::max(begin, a), end);
+			const size_t next = std::max(begin, std::min(end, a+1));
+			simd_pull(px + begin, py + begin, vx + begin, vy + begin, radius + begin, mid - begin,
+				px[a], py[a], am, rx, ry);
+			simd_pull(px + next, py + next, vx + next, vy + next, radius + next, end - next,
+				px[a], py[a], am, rx, ry);
+			chunk_reaction[c] = vec2(rx, ry);
+		});
+		vec2 reaction(0);
+		for (const vec2& r : chunk_reaction) reaction += r;
+		vx[a] -= reaction.x * gravity;
+		vy[a] -= reaction.y * gravity;
+	}
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::AttractAll(const float& dt, const float& theta, ThreadPool* pool, size_t chunk) {
+	const float gravity = GRAVITY_CONSTANT * dt;
+	const size_t n = motes.size();
+	mass.resize(n);
+	for (size_t i = 0; i < n; i++)
+		mass[i] = motes.radius[i] * motes.radius[i];
+	mass_tree.Build(motes.px.data(), motes.py.data(), mass.data(), n);
+	
+	ParallelFor(pool, n, chunk, [&](size_t begin, size_t end, size_t) {
+		for (size_t i = begin; i < end; i++) {
+			const vec2 acc = mass_tree.Accel(i, motes.px[i], motes.py[i], theta, GRAVITY_SOFTENING);
+			motes.vx[i] += acc.x * gravity;
+			motes.vy[i] += acc.y * gravity;
+		}
+	});
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::Integrate(const float& dt, ThreadPool* pool, size_t chunk) {
+	float* px = motes.px.data();
+	float* py = motes.py.data();
+	const float* vx = motes.vx.data();
+	const float* vy = motes.vy.data();
+	//coasting motes get their start where they are once a test finds them
+	if (sweep) {
+		start_x.assign(px, px + awake), start_x.resize(motes.size());
+		start_y.assign(py, py + awake), start_y.resize(motes.size());
+	}
+	ParallelFor(pool, awake, chunk, [&](size_t begin, size_t end, size_t) {
+		simd_integrate(px + begin, py + begin, vx + begin, vy + begin, end - begin, dt);
+	});
 	// vel = vel * powf(0.9, dt);
+}
+
+template <typename BroadPhase>
+float BasicGame<BroadPhase>::SplitChance(uint32_t i, const float& dt) const {
+	float split_k = fminf(powf(motes.radius[i] / GetCriticalRadius(motes.type[i]), 8), 1.);
+	return 1. - powf(1 - split_k, dt);
+}
+
+template <typename BroadPhase>
+MoteAction BasicGame<BroadPhase>::UpdateSplit(uint32_t i, const sim_params& param, const float& dt, float roll) {
+	MoteAction act;
+	float& split_cooldown = motes.split_cooldown[i];
 	
 	if (split_cooldown > 0) {
 		split_cooldown -= dt;
 	} else if (param.allow_splitting) {
-		float split_k = fminf(powf(radius / this->GetCriticalRadius(), 8), 1.);
-		const float split_chance = 1. - powf(1 - split_k, dt);
-		if (rand_float() <= split_chance) {
-			const float q = rand_float(0, 2*M_PI);
+		if (roll <= SplitChance(i, dt)) {
+			const float q = 2*M_PI * rng_unit(rng_philox(seed, motes.id[i], step, RNG_SPLIT).v[1]);
 			act.Split(vec2(cos(q), sin(q)), 0.25);
 			split_cooldown = SPLIT_COOLDOWN;
 		}
@@ -250,76 +561,89 @@ MoteAction Mote::Update(const sim_params& param, const float& dt) {
 	return act;
 }
 
-void Mote::CollideSurface(const vec2& normal, const float& dist) {
-	pos += normal * dist;
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::CollideSurface(uint32_t i, const vec2& normal, const float& dist) {
+	motes.SetPos(i, motes.Pos(i) + normal * dist);
+	const vec2 vel = motes.Vel(i);
 	if (vel.dot(normal) >= 0) return;
-	vel -= normal * 2 * vel.dot(normal);
+	motes.SetVel(i, vel - normal * 2 * vel.dot(normal));
 	// vel = vel * 0.9;
 }
 
-void Mote::CollideMote(Mote* m) {
-	if (m->radius > radius) {
-		m->CollideMote(this);
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::GatherCandidates(uint32_t i, const AABB& box, bool after_only, Candidates& out) const {
+	out.clear();
+	const Handle h = motes.handle[i];
+	out.queries++;
+	broadphase.GetInside(box, [&](Handle other) {
+		out.scanned++;
+		if (other == h) return;
+		const int64_t j = motes.Find(other);
+		if (j < 0 || (after_only && j < i) || motes.radius[j] < 0) return; //dead motes stay until the step ends
+		out.index.push_back(j);
+		out.x.push_back(motes.px[j]);
+		out.y.push_back(motes.py[j]);
+		out.r.push_back(motes.radius[j] + Travel(j));
+	});
+}
+
+//whether motes i and j touch now or passed through each other during the step, d is the distance to collide them at
+template <typename BroadPhase>
+bool BasicGame<BroadPhase>::Touching(uint32_t i, uint32_t j, float& d) const {
+	const Circle ci = motes.GetCircle(i), cj = motes.GetCircle(j);
+	if (ci.r <= 0 || cj.r <= 0) return false;
+	if (circle_circle_coll(ci, cj)) {
+		d = (ci.pos - cj.pos).length();
+		return true;
+	}
+	if (!sweep) return false;
+	//a fast mote may have passed through the other one during the step, it goes as deep as they got
+	const Circle si(vec2(start_x[i], start_y[i]), ci.r), sj(vec2(start_x[j], start_y[j]), cj.r);
+	float t;
+	if (!circle_circle_toi(si, ci.pos - si.pos, sj, cj.pos - sj.pos, t)) return false;
+	d = circle_circle_closest(si, ci.pos - si.pos, sj, cj.pos - sj.pos);
+	return true;
+}
+
+template <typename BroadPhase>
+AABB BasicGame<BroadPhase>::MoteBox(uint32_t i) const {
+	const AABB end = motes.GetAABB(i);
+	if (!sweep) return end;
+	const AABB start = Circle(vec2(start_x[i], start_y[i]), motes.radius[i]).GetAABB();
+	return AABB(
+		{std::min(start.A.x, end.A.x), std::min(start.A.y, end.A.y)},
+		{std::max(start.B.x, end.B.x), std::max(start.B.y, end.B.y)}
+	);
+}
+
+//the bigger mote absorbs part of the smaller one
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::CollideMotes(uint32_t i, uint32_t j, float d) {
+	if (motes.radius[j] > motes.radius[i]) {
+		CollideMotes(j, i, d);
 		return;
 	}
+	float& radius = motes.radius[i];
+	float& other_radius = motes.radius[j];
 	
 	const float old_a = radius * radius;
-	const float d = (pos - m->pos).length(); //distance
 	const float h = d * 0.5;
-	const float a = m->radius * m->radius + old_a;
+	const float a = other_radius * other_radius + old_a;
 	const float q = sqrt(0.5*a - h*h);
 	
 	//calculate new radii
 	radius = h + q;
-	m->radius = h - q;
-	if (m->radius < MIN_RADIUS) {
-		m->radius = -1;
+	other_radius = h - q;
+	if (other_radius < MIN_RADIUS) {
+		other_radius = -1;
 		radius = sqrt(a);
 	}
 	
 	//momentum transfer
 	const float k = old_a / (radius * radius);
-	vel = vel * k + m->vel * (1-k);
+	motes.SetVel(i, motes.Vel(i) * k + motes.Vel(j) * (1-k));
 }
 
-void Mote::AttractTowards(const MotePtr& m, const float& dt) {
-	const float gravity = GRAVITY_CONSTANT * dt;
-	const vec2 delta = m->pos - pos;
-	const float dist2 = delta.length2();
-	const vec2 dir = delta.normalized() * gravity / dist2;
-	
-	vel += dir * (m->radius * m->radius);
-	m->vel -= dir * (radius * radius);
-}
-
-void RenderCircleTex(const float x, const float y, const float r, const float rot, const texture_id id) {
-	const Texture2D tx = tex[id];
-	const float scale = tex_scalars[id];
-	const Rectangle src = {0, 0, (float)tx.width, (float)tx.height};
-	const Rectangle dst = {x, y, r*2*scale, r*2*scale};
-	const Vector2 origin = {r*scale, r*scale};
-	
-	DrawTexturePro(tx, src, dst, origin, rot, WHITE);
-}
-
-void Mote::RenderExtra(const float& x, const float& y, const float& r, const sim_params& param) const {
-	if (param.show_colliders) DrawCircleLines(static_cast<int>(round(x)), static_cast<int>(round(y)), r, WHITE);
-}
 
-void Mote::Render(const Viewport& view, sim_params& param, const float time) const {
-	//screen coordinates
-	const auto [x, y] = view.ToScreen(pos.x, pos.y);
-	const float r = radius * view.zoom;
-	
-	RenderCircleTex(x, y, r, 0, TEXTURE_AMBIENT);
-	RenderExtra(x, y, r, param);
-}
-
-void AttractorMote::Render(const Viewport& view, sim_params& param, const float time) const {
-	//screen coordinates
-	const auto [x, y] = view.ToScreen(pos.x, pos.y);
-	const float r = radius * view.zoom;
-	
-	RenderCircleTex(x, y, r, 0, TEXTURE_ATTRACTOR);
-	RenderExtra(x, y, r, param);
-}
+template class BasicGame<GridBroadPhase>;
+template class BasicGame<SapBroadPhase>;
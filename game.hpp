@@ -1,9 +1,16 @@
 #pragma once
+#include <array>
 #include <memory>
-#include <unordered_map>
-#include <raylib.h>
+#include <optional>
+#include <utility>
+#include <vector>
 #include "common.hpp"
 #include "collision.hpp"
+#include "motes.hpp"
+#include "gravity.hpp"
+#include "parallel.hpp"
+#include "rng.hpp"
+#include "sap.hpp"
 
 
 struct Viewport {
@@ -15,16 +22,6 @@ struct Viewport {
 	std::pair<float, float> ToScreen(float x, float y) const;
 };
 
-//game textures
-const int TEX_AMOUNT = 256;
-extern Texture2D tex[TEX_AMOUNT];
-extern float tex_scalars[TEX_AMOUNT];
-enum texture_id {
-	TEXTURE_AMBIENT, TEXTURE_ATTRACTOR, TEXTURE_AI, TEXTURE_PLAYER
-};
-
-bool InitTextures(void);
-
 struct debug_log {
 	static constexpr int LOG_SIZE = 4096;
 	char dat[LOG_SIZE];
@@ -42,9 +39,23 @@ struct sim_params {
 	bool show_grid : 1;
 	bool show_grid_colliders : 1;
 	bool allow_splitting : 1;
+	bool nbody_gravity : 1; //every mote attracts every other one (Barnes-Hut)
+	bool deterministic : 1; //parallel steps give the same result for any thread count
+	bool auto_depth : 1; //retune the grid depth every GRID_TUNE_INTERVAL steps
+	bool swept : 1; //motes collide anywhere along their path during a step, not only where it ends
+	//isolated motes coast along closed form orbits (see game_coast.cpp), only with a single
+	//attractor, no mote to mote gravity, the serial step and no block steps
+	bool kepler : 1;
+	float bh_theta; //Barnes-Hut opening angle, lower is more accurate
+	int threads; //1 runs the serial reference step
+	//block steps (see game_blocks.cpp), motes take steps down to dt / 2^block_levels as they need
+	//0 steps every mote with dt, otherwise the step is serial and swept is ignored
+	int block_levels;
 	
 	sim_params(debug_log& log)
-	: log(log), show_colliders(false), show_grid(false), show_grid_colliders(false)
+	: log(log), show_colliders(false), show_grid(false), show_grid_colliders(false),
+	  allow_splitting(false), nbody_gravity(false), deterministic(true), auto_depth(false), swept(false), kepler(false),
+	  bh_theta(0.5), threads(1), block_levels(0)
 	{}
 };
 
@@ -67,78 +78,271 @@ struct MoteAction {
 	MoteAction() : split_dir(0), split_amount(-1) {}
 };
 
-constexpr float MIN_RADIUS = 0.0005;
-constexpr float SPLIT_COOLDOWN = 0.1;
-constexpr float GRAVITY_CONSTANT = 1;
-constexpr float SPLIT_VELOCITY = 0.5;
+constexpr int GRID_DEPTH = 6; //default, levels below the root
+constexpr int GRID_MAX_DEPTH = 10;
+constexpr int GRID_TUNE_INTERVAL = 120;
+constexpr int MAX_BLOCK_LEVELS = 8;
+constexpr float BLOCK_ACCURACY = 0.25; //share of its shortest time scale a mote may step at once
+constexpr int COAST_STEPS = 30; //steps a mote coasts before it is tested again
+constexpr int COAST_MIN_WAIT = 16; //steps between tries after a mote first fails to coast
+constexpr int COAST_MAX_WAIT = 1024; //most steps between tries of a mote that keeps failing
+constexpr float COAST_TOLERANCE = 0.1; //how far the attractor may stray from an orbit's center, in mote radii
 
-class Mote;
-using MotePtr = std::shared_ptr<Mote>;
-
-class Mote {
-protected:
-	//call this on every Render() override
-	void RenderExtra(const float& x, const float& y, const float& r, const sim_params& param) const;
+//memory held by a game, see BasicGame::GetMemoryStats()
+struct memory_stats {
+	pool_stats motes; //the mote store and its handles
+	pool_stats broadphase; //ids in the grid, zero for other broad-phases
+	size_t scratch; //bytes of the buffers steps reuse (spawns, candidates, pairs, gravity tree...)
 	
+	size_t Bytes(void) const { return motes.bytes + broadphase.bytes + scratch; }
+};
+
+class Snapshot;
+class Recorder;
+
+//simulation state, has no dependency on raylib (see render.hpp for drawing)
+//BroadPhase finds motes whose bounding boxes overlap, see Grid and SweepAndPrune
+template <typename BroadPhase>
+class BasicGame {
 public:
-	vec2 pos, vel;
-	float radius;
-	float time_offset;
-	float split_cooldown;
+	static constexpr size_t PARALLEL_CHUNK = 4096; //motes per task in deterministic mode
+	using BroadPhaseType = BroadPhase;
 	
-	Mote(vec2 pos, float r) : pos(pos), vel(0), radius(r), split_cooldown(SPLIT_COOLDOWN) {
-		time_offset = rand_float(0, 256);
-	}
+private:
+	MoteStore motes;
+	std::vector<Handle> attractors; //in the order they were added
+	BroadPhase broadphase;
+	uint64_t next_id;
+	uint64_t seed;
+	uint64_t step; //amount of updates so far, part of every random draw
+	float total_area;
+	//collision candidates of one mote, packed for simd_first_overlap
+	//r includes the Travel() of the mote, so two of them can only have touched if their circles overlap
+	struct Candidates {
+		std::vector<uint32_t> index;
+		std::vector<float> x, y, r;
+		//broad-phase queries and the ids they returned, kept by clear() for depth tuning
+		uint64_t queries = 0, scanned = 0;
+		
+		void clear(void) { index.clear(), x.clear(), y.clear(), r.clear(); }
+		size_t size(void) const { return index.size(); }
+	};
+	Candidates candidates; //reused by the serial step
+	//spawns and removals recorded during a step, ApplyCommands() carries them out at its end
+	//so the store, the attractor list and the broad-phase don't change while motes are visited
+	struct Commands {
+		std::vector<Mote> spawn; //split children, added in order
+		std::vector<uint32_t> kill; //store indices of dead motes, their radius is already -1
+		
+		void clear(void) { spawn.clear(), kill.clear(); }
+	};
+	Commands commands;
+	MassTree mass_tree;
+	std::vector<float> mass; //r^2 of every mote, input of mass_tree
+	//swept collisions, set by Update() from sim_params::swept
+	bool sweep;
+	std::vector<float> start_x, start_y; //positions before integration
 	
-	AABB GetAABB() const { return Circle(pos, radius).GetAABB(); }
-	Circle GetCircle() const { return Circle(pos, radius); }
+	//block step state
+	std::vector<uint8_t> level; //per mote, it steps dt / 2^level at a time
+	std::vector<std::vector<uint32_t>> level_motes; //store indices by level
+	std::vector<uint16_t> drifted; //per mote, the substep its position belongs to
+	HandleTable<float> approach; //shortest time until a neighbour reaches the mote, from its last test
+	std::vector<vec2> pull_terms; //per attractor, from the last Pull()
+	uint64_t mote_updates; //collision tests of motes so far
 	
-	//mote property getter functions
-	virtual bool IsAttractor(void) const { return false; }
-	virtual float GetCriticalRadius(void) const { return 0.075; }
+	//coasting motes, coast_on is set by Update() from sim_params::kepler
+	//they sit at the end of the store, the passes over every mote and the step's loop stop at awake
+	uint32_t awake; //motes before this index are stepped, all of them unless some coast
+	struct coast_state {
+		kepler_orbit orbit; //around where the track puts the attractor
+		double epoch; //time the orbit starts at
+		double placed; //time Place() last put the mote on its orbit
+		uint64_t since; //first step the mote skipped
+		uint64_t wake; //step the mote is tested again, the first one whose split roll splits it at most
+		vec2 vel; //velocity as the coast started, the attractor gets the difference back on waking
+		AABB box; //what is in the broad-phase, holds the whole path until then
+	};
+	//the line every coasting orbit moves along, a straight one from where the attractor was at epoch
+	struct coast_track {
+		Handle attractor;
+		vec2 center, frame; //its position and velocity then
+		double epoch;
+		float mu; //its gravitational parameter then
+		float stray; //how far it may get off the line before the orbits are refitted
+		float mu_slack; //how far mu may drift before they are
+		float dt; //step the wakes and split rolls were counted in
+		bool splitting; //whether the split rolls were made with splitting allowed
+	};
+	bool coast_on;
+	HandleTable<coast_state> coast;
+	coast_track track; //only meaningful while some mote coasts
+	std::array<std::vector<Handle>, COAST_STEPS + 1> coast_due; //by wake step modulo COAST_STEPS + 1
+	std::vector<Handle> regroup; //motes that started or stopped coasting since Regroup() last ran
+	struct coast_backoff {
+		uint64_t next; //step of the next try
+		uint32_t wait; //steps from the last failure to the next try
+	};
+	HandleTable<coast_backoff> backoff; //motes whose last try to coast failed or whose coast ended early
+	double time; //simulated seconds so far
 	
-	void AttractTowards(const MotePtr& m, const float& dt);
+	//parallel step state, all of it is reused between steps
+	std::unique_ptr<ThreadPool> pool;
+	std::vector<vec2> chunk_reaction; //per chunk pull on the current attractor
+	std::vector<std::vector<std::pair<uint32_t, uint32_t>>> chunk_pairs;
+	std::vector<Candidates> chunk_candidates;
+	std::vector<std::pair<uint32_t, uint32_t>> pairs; //overlapping motes, first < second
+	std::vector<uint32_t> island_parent; //union-find over mote indices
+	std::vector<uint32_t> island_id; //root -> island
+	std::vector<uint32_t> island_start, island_fill; //island -> first entry in island_pairs
+	std::vector<uint32_t> island_pairs, pair_island; //pairs grouped by island, pair -> island
+	std::vector<uint8_t> touched;
+	std::vector<float> split_roll;
+	std::vector<Commands> chunk_commands; //merged into commands in chunk order
+	Recorder* recorder; //not owned, may be null
 	
-	virtual MoteAction Update(const sim_params& param, const float& dt);
-	virtual void CollideSurface(const vec2& normal, const float& dist);
-	virtual void CollideMote(Mote* m);
+	ThreadPool* GetPool(int threads);
+	size_t ChunkSize(const sim_params& param, size_t n) const;
+	uint32_t FindIsland(uint32_t i);
 	
-	virtual void Render(const Viewport& view, sim_params& param, const float time) const;
-};
-
-class AttractorMote : public Mote {
-public:
-	AttractorMote(vec2 pos, float r) : Mote(pos, r) {};
+	void UpdateSerial(const sim_params& param, const float& dt);
+	void UpdateParallel(const sim_params& param, const float& dt);
+	void DetectCollisions(ThreadPool* pool, size_t chunk);
+	void ResolveCollisions(ThreadPool* pool);
+	void UpdateBlocks(const sim_params& param, const float& dt);
 	
-	bool IsAttractor(void) const override { return true; }
-	float GetCriticalRadius(void) const override { return 1; }
+	//per mote physics, indices refer to the mote store
+	//passes taking a pool run serially when it is null
+	void Attract(const float& dt, ThreadPool* pool, size_t chunk);
+	void AttractAll(const float& dt, const float& theta, ThreadPool* pool, size_t chunk);
+	void Integrate(const float& dt, ThreadPool* pool, size_t chunk);
+	//pull of the attractors on mote i per unit of gravity, the terms of every attractor are kept
+	//in pull_terms for React()
+	vec2 Pull(uint32_t i);
+	//every attractor gets react times the opposite of its term in the last Pull(i), weighted by the
+	//mote's mass
+	void React(uint32_t i, float react);
+	//coarsest level whose step is short enough for the acceleration and the neighbours of mote i
+	int BlockLevel(uint32_t i, const vec2& acc, const float& dt, int levels) const;
+	//box around mote i and where it drifts in the next t seconds
+	AABB PathBox(uint32_t i, float t) const;
+	//shortest time until one of the candidates closes in on mote i, only looks at the ones within
+	//a few times their sizes plus reach, infinite if none of those approaches
+	float ApproachTime(uint32_t i, const Candidates& c, float reach) const;
+	//whether this step may let motes coast, see sim_params::kepler
+	bool CanCoast(const sim_params& param) const;
+	//refits the orbits once the attractor strays off the track or its mass drifts, then wakes the
+	//motes whose coast ends this step
+	void UpdateCoasting(void);
+	//lets mote i coast until COAST_STEPS from now if nothing else is near its path, true if it does
+	bool TryCoast(uint32_t i, const float& dt, const sim_params& param);
+	//whether mote h may try to coast this step, after a failed try or a coast that ended early
+	//Backoff() doubles the steps until the next one
+	bool CoastDue(Handle h) const;
+	void Backoff(Handle h);
+	//puts coasting mote i where its orbit is now, a no-op for other motes
+	void Place(uint32_t i);
+	void PlaceCoasting(void);
+	//mote h is tested every step again from step next on, it goes back into the broad-phase with its
+	//own box and its row moves at the next Regroup()
+	void Wake(Handle h, uint64_t next);
+	void WakeAll(void);
+	//moves the rows of the motes in regroup to their side of awake
+	void Regroup(void);
+	float SplitRoll(uint32_t i, uint64_t s) const { return rng_float(seed, motes.id[i], s, RNG_SPLIT); }
+	float SplitRoll(uint32_t i) const { return SplitRoll(i, step); }
+	//chance that mote i splits in a step of dt once its cooldown ran out
+	float SplitChance(uint32_t i, const float& dt) const;
+	//roll is the mote's SplitRoll() for this step
+	MoteAction UpdateSplit(uint32_t i, const sim_params& param, const float& dt, float roll);
+	//shrinks mote i and records the child, safe to call for different motes at once
+	void Split(uint32_t i, const MoteAction& act, Commands& cmd);
+	void CollideSurface(uint32_t i, const vec2& normal, const float& dist);
+	//d is the distance between their centers where they overlap the most
+	void CollideMotes(uint32_t i, uint32_t j, float d);
+	//whether motes i and j overlap at the end of the step or, when sweeping, anywhere on the way there
+	//d is what CollideMotes() takes
+	bool Touching(uint32_t i, uint32_t j, float& d) const;
+	//what goes into the broad-phase, the box around the whole path of the step when sweeping
+	AABB MoteBox(uint32_t i) const;
+	//how far a mote moved during the step when sweeping, 0 otherwise
+	float Travel(uint32_t i) const {
+		return sweep ? (motes.Pos(i) - vec2(start_x[i], start_y[i])).length() : 0;
+	}
+	//fills out with the motes whose bounding boxes overlap mote i, in broad-phase order
+	//only motes after i in the store are kept when after_only is set
+	void GatherCandidates(uint32_t i, bool after_only, Candidates& out) const {
+		GatherCandidates(i, MoteBox(i), after_only, out);
+	}
+	//same with the motes overlapping box
+	void GatherCandidates(uint32_t i, const AABB& box, bool after_only, Candidates& out) const;
 	
-	void Render(const Viewport& view, sim_params& param, const float time) const override;
-};
-
-
-class Game {
-private:
-	static constexpr int GRID_DEPTH = 6;
-	std::unordered_map<uint64_t, MotePtr> motes;
-	std::unordered_map<uint64_t, MotePtr> attractors;
-	Grid<uint64_t, GRID_DEPTH> grid;
-	uint64_t next_id;
+	//picks a grid depth from the occupancy of the deepest level and the ids returned per query
+	void TuneGridDepth(void);
 	
-	void RenderGridRecursive(const Viewport& view, int x, int y, int d) const;
+	//marks a mote dead, it is skipped as a collision candidate until ApplyCommands() removes it
+	void Kill(uint32_t i, Commands& cmd);
+	//removes the dead motes from the broad-phase and the store, then adds the children and moves
+	//the motes that started or stopped coasting to their side of awake
+	void ApplyCommands(void);
 	
 public:
 	AABB bounds;
 	
-	Game(const AABB bb);
+	//grid_depth only applies to the grid broad-phase
+	BasicGame(const AABB bb, uint64_t seed = 1, int grid_depth = GRID_DEPTH);
+	
+	//motes are referred to by handles, which go stale once the mote is gone
+	Handle AddMote(const Mote& m);
+	std::optional<Mote> GetMote(Handle h) const;
+	bool SetMote(Handle h, const Mote& m);
+	void RemoveMote(Handle h);
 	
-	uint64_t AddMote(MotePtr m);
-	MotePtr GetMote(uint64_t id) const;
-	void RemoveMote(uint64_t id);
+	//writes the whole world to a snapshot file (see snapshot.hpp), false on I/O errors
+	bool Save(const char* path) const;
+	//replaces the world with an open snapshot and takes over its bounds, false if it isn't open
+	bool Load(const Snapshot& snap);
+	//every Update() hands the new state to the recorder, null stops recording
+	//the recorder has to outlive the game or be replaced before it is destroyed
+	void SetRecorder(Recorder* r) { recorder = r; }
 	
-	bool CheckSurface(const MotePtr m, vec2& norm, float& dist);
+	bool CheckSurface(uint32_t i, vec2& norm, float& dist) const;
 	
+	//rebuilds the grid with d levels below the root (0 - GRID_MAX_DEPTH) and gives the Barnes-Hut tree as
+	//many, a no-op for other broad-phases
+	void SetGridDepth(int d);
+	//-1 for other broad-phases
+	int GetGridDepth(void) const;
+	
+	//runs the serial reference step or, when param.threads > 1, the parallel one
 	void Update(const sim_params& param, const float& dt);
+	//runs a batch of fixed steps back to back
+	//keep_previous saves positions before the last one so rendering can interpolate
+	//coasting motes are only put where they are before that and at the end
+	void Step(const sim_params& param, const float& dt, int steps, bool keep_previous = false);
 	
-	void Render(const Viewport& view, sim_params& param, const float time) const;
+	//state queries
+	const BroadPhase& GetBroadPhase(void) const { return broadphase; }
+	BroadPhase& GetBroadPhase(void) { return broadphase; }
+	//coasting motes are where the last Step() left them
+	const MoteStore& GetMotes(void) const { return motes; }
+	const std::vector<Handle>& GetAttractors(void) const { return attractors; }
+	size_t MoteCount(void) const { return motes.size(); }
+	uint64_t GetSeed(void) const { return seed; }
+	uint64_t GetStep(void) const { return step; }
+	//collision tests of motes so far, one per mote and step unless block steps or coasting skip some
+	uint64_t GetMoteUpdates(void) const { return mote_updates; }
+	size_t CoastingCount(void) const { return coast.size(); }
+	float GetTotalArea(void) const { return total_area; } //sum of r^2, updated every step
+	//walks every grid cell, meant for reports rather than every step
+	memory_stats GetMemoryStats(void) const;
 };
+
+//instantiated in game.cpp and game_parallel.cpp
+using GridBroadPhase = Grid<Handle, GRID_MAX_DEPTH>;
+using SapBroadPhase = SweepAndPrune<Handle>;
+extern template class BasicGame<GridBroadPhase>;
+extern template class BasicGame<SapBroadPhase>;
+
+using Game = BasicGame<GridBroadPhase>;
+using SapGame = BasicGame<SapBroadPhase>;
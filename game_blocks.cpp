@@ -0,0 +1,277 @@
+#include "game.hpp"
+#include "collision.hpp"
+#include "profile.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+//Block steps
+//Every mote gets a level and steps dt / 2^level at a time, the coarsest step that resolves its
+//acceleration and the neighbours closing in on it. A step of dt is split into 2^levels substeps.
+//Gravity only kicks a mote at the start of its own step and its collisions are tested at the end of
+//it. In between it drifts in a straight line, so it is only moved when something looks at it: its
+//own kick and test, a test that finds it as a candidate, the attractors' pull and the end of dt.
+//At the start of its step a mote goes into the broad-phase with the box of its whole drift, so the
+//motes tested in between still find it. Levels, splits and removals wait for the end of dt.
+//With n-body gravity the mass tree is only rebuilt as the coarsest level in use starts a step, the
+//finer levels' kicks in between feel the far field of that moment.
+
+
+template <typename BroadPhase>
+vec2 BasicGame<BroadPhase>::Pull(uint32_t i) {
+	vec2 acc(0);
+	const vec2 p = motes.Pos(i);
+	pull_terms.resize(attractors.size());
+	for (size_t k = 0; k < attractors.size(); k++) {
+		const int64_t a = motes.Find(attractors[k]);
+		pull_terms[k] = vec2(0);
+		if (a == i || motes.radius[a] < 0) continue; //dead attractors stay until the step ends
+		const vec2 d = motes.Pos(a) - p;
+		const float dist2 = d.length2();
+		const vec2 dk = d * (1.f / (sqrtf(dist2) * dist2)); //normalized direction / dist2
+		acc += dk * (motes.radius[a] * motes.radius[a]);
+		pull_terms[k] = dk;
+	}
+	return acc;
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::React(uint32_t i, float react) {
+	const float m = motes.radius[i] * motes.radius[i];
+	for (size_t k = 0; k < attractors.size(); k++) {
+		const int64_t a = motes.Find(attractors[k]);
+		motes.vx[a] -= pull_terms[k].x * m * react;
+		motes.vy[a] -= pull_terms[k].y * m * react;
+	}
+}
+
+template <typename BroadPhase>
+int BasicGame<BroadPhase>::BlockLevel(uint32_t i, const vec2& acc, const float& dt, int levels) const {
+	float t = std::numeric_limits<float>::infinity();
+	//time in which the mote strays about its own size from a straight line
+	const float a = acc.length() * GRAVITY_CONSTANT;
+	if (a > 0) t = sqrtf(motes.radius[i] / a);
+	if (const float* near = approach.Find(motes.handle[i])) t = std::min(t, *near);
+	
+	const float limit = BLOCK_ACCURACY * t;
+	int l = 0;
+	while (l < levels && dt / (1 << l) > limit) l++;
+	return l;
+}
+
+template <typename BroadPhase>
+AABB BasicGame<BroadPhase>::PathBox(uint32_t i, float t) const {
+	const Circle c = motes.GetCircle(i);
+	const vec2 e = c.pos + motes.Vel(i) * t;
+	return AABB(
+		std::min(c.pos.x, e.x) - c.r, std::min(c.pos.y, e.y) - c.r,
+		std::max(c.pos.x, e.x) + c.r, std::max(c.pos.y, e.y) + c.r
+	);
+}
+
+template <typename BroadPhase>
+float BasicGame<BroadPhase>::ApproachTime(uint32_t i, const Candidates& c, float reach) const {
+	const float px = motes.px[i], py = motes.py[i], vx = motes.vx[i], vy = motes.vy[i];
+	const float r = motes.radius[i];
+	float t = std::numeric_limits<float>::infinity();
+	for (size_t k = 0; k < c.size(); k++) {
+		const float dx = c.x[k] - px, dy = c.y[k] - py;
+		const float s = 4 * (r + c.r[k]) + reach;
+		const float dist2 = dx*dx + dy*dy;
+		if (dist2 > s*s || dist2 <= 0) continue;
+		const uint32_t j = c.index[k];
+		//receding neighbours are dropped before paying for the distance
+		const float dot = dx * (motes.vx[j] - vx) + dy * (motes.vy[j] - vy);
+		if (dot >= 0) continue;
+		const float dist = sqrtf(dist2);
+		const float closing = -dot / dist;
+		//motes already touching still get the time to pass through the smaller one
+		const float gap = std::max(dist - r - c.r[k], 0.f);
+		t = std::min(t, (gap + std::min(r, c.r[k])) / closing);
+	}
+	return t;
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::UpdateBlocks(const sim_params& param, const float& dt) {
+	const int levels = std::min(param.block_levels, MAX_BLOCK_LEVELS);
+	const int substeps = 1 << levels;
+	const float h = dt / substeps;
+	const uint32_t n = motes.size();
+	//motes on this level and finer start and end their steps at the start of substep t
+	auto lowest = [&](int t) { return t % substeps == 0 ? 0 : levels - __builtin_ctz(t); };
+	//time from the start of substep t until mote j ends its step, a step starting at t counts
+	auto remaining = [&](uint32_t j, int t) {
+		const int stride = substeps >> level[j];
+		return ((t / stride + 1) * stride - t) * h;
+	};
+	
+	level.resize(n);
+	level_motes.resize(levels + 1);
+	for (std::vector<uint32_t>& l : level_motes) l.clear();
+	drifted.assign(n, 0);
+	if (param.nbody_gravity) mass.resize(n);
+	//moves mote j on to the start of substep t
+	auto drift = [&](uint32_t j, int t) {
+		if (drifted[j] == t) return;
+		const float span = (t - drifted[j]) * h;
+		motes.px[j] += motes.vx[j] * span;
+		motes.py[j] += motes.vy[j] * span;
+		drifted[j] = t;
+	};
+	int coarsest = 0; //coarsest level holding motes
+	
+	PROFILE_LAPS(laps);
+	for (int s = 0; s < substeps; s++) {
+		if (param.nbody_gravity && lowest(s) <= coarsest) {
+			for (uint32_t i = 0; i < n; i++) {
+				drift(i, s);
+				mass[i] = motes.radius[i] > 0 ? motes.radius[i] * motes.radius[i] : 0;
+			}
+			mass_tree.Build(motes.px.data(), motes.py.data(), mass.data(), n);
+		}
+		//the motes starting a step ended the last one there, only the attractors lag behind
+		for (Handle ah : attractors) drift(motes.Find(ah), s);
+		//the attractors' reactions are left to the caller, see React()
+		auto accel = [&](uint32_t i) {
+			if (param.nbody_gravity) return mass_tree.Accel(i, motes.px[i], motes.py[i], param.bh_theta, GRAVITY_SOFTENING);
+			return Pull(i);
+		};
+		auto kick = [&](uint32_t i, const vec2& acc) {
+			const float step_dt = dt / (1 << level[i]);
+			motes.SetVel(i, motes.Vel(i) + acc * (GRAVITY_CONSTANT * step_dt));
+			broadphase.Insert(motes.handle[i], PathBox(i, step_dt));
+		};
+		
+		//kick the motes starting a step, at the start of dt every mote also gets its level
+		if (s == 0) {
+			for (uint32_t i = 0; i < n; i++) {
+				const vec2 acc = accel(i);
+				level[i] = BlockLevel(i, acc, dt, levels);
+				level_motes[level[i]].push_back(i);
+				//attractors only get the reactions once the step is known
+				if (!param.nbody_gravity) React(i, GRAVITY_CONSTANT * dt / (1 << level[i]));
+				kick(i, acc);
+			}
+			while (coarsest < levels && level_motes[coarsest].empty()) coarsest++;
+		} else {
+			for (int l = lowest(s); l <= levels; l++)
+				for (uint32_t i : level_motes[l]) {
+					if (motes.radius[i] < 0) continue;
+					const vec2 acc = accel(i);
+					if (!param.nbody_gravity) React(i, GRAVITY_CONSTANT * dt / (1 << l));
+					kick(i, acc);
+				}
+		}
+		//the reactions bent the paths of the attractors
+		if (!param.nbody_gravity)
+			for (Handle ah : attractors) {
+				const int64_t a = motes.Find(ah);
+				if (motes.radius[a] >= 0) broadphase.Insert(ah, PathBox(a, remaining(a, s)));
+			}
+		PROFILE_LAP(laps, PROF_ATTRACT);
+		
+		//move the motes ending a step to its end, at the end of dt that is all of them
+		const bool last = s + 1 == substeps;
+		if (last) {
+			for (uint32_t i = 0; i < n; i++)
+				drift(i, s + 1);
+		} else {
+			for (int l = lowest(s + 1); l <= levels; l++)
+				for (uint32_t i : level_motes[l])
+					drift(i, s + 1);
+		}
+		for (Handle ah : attractors) drift(motes.Find(ah), s + 1);
+		PROFILE_LAP(laps, PROF_INTEGRATE);
+		
+		//test the motes ending a step
+		auto test = [&](uint32_t i) {
+			if (motes.radius[i] < 0) return; //absorbed earlier this step
+			mote_updates++;
+			const Handle hi = motes.handle[i];
+			bool changed = false;
+			
+			vec2 norm;
+			float dist;
+			if (CheckSurface(i, norm, dist)) {
+				CollideSurface(i, norm, dist);
+				changed = true;
+			}
+			PROFILE_LAP(laps, PROF_SURFACE);
+			
+			if (last) {
+				const MoteAction act = UpdateSplit(i, param, dt, param.allow_splitting ? SplitRoll(i) : 1);
+				if (act.IsSplitting()) Split(i, act, commands);
+			}
+			PROFILE_LAP(laps, PROF_SPLIT);
+			
+			//what closes in on the mote decides its next level, at the end of dt a mote that crosses
+			//several times its size per dt looks as far as it gets during the next one
+			//of two motes closing in the faster one moves at least half their closing speed, so the
+			//slower ones only have to look at close neighbours
+			AABB box = motes.GetAABB(i);
+			float reach = motes.Vel(i).length() * dt;
+			if (reach <= 4 * motes.radius[i]) reach = 0;
+			else if (last) box = AABB(box.A.x - reach, box.A.y - reach, box.B.x + reach, box.B.y + reach);
+			GatherCandidates(i, box, false, candidates);
+			//candidates between their kicks and tests are moved up to the test
+			for (size_t k = 0; k < candidates.size(); k++) {
+				const uint32_t j = candidates.index[k];
+				if (drifted[j] == s + 1) continue;
+				drift(j, s + 1);
+				candidates.x[k] = motes.px[j];
+				candidates.y[k] = motes.py[j];
+			}
+			if (last) approach[hi] = ApproachTime(i, candidates, 2 * reach / BLOCK_ACCURACY);
+			PROFILE_LAP(laps, PROF_BROADPHASE);
+			
+			Circle ci = motes.GetCircle(i);
+			for (size_t k = 0; ci.r > 0; k++) {
+				k = simd_first_overlap(ci.pos.x, ci.pos.y, ci.r, candidates.x.data(), candidates.y.data(),
+					candidates.r.data(), k, candidates.size());
+				if (k == candidates.size()) break;
+				const uint32_t j = candidates.index[k];
+				CollideMotes(i, j, (ci.pos - motes.Pos(j)).length());
+				//the other mote may be in the middle of its step, its box has to cover the new path
+				if (motes.radius[j] <= 0) Kill(j, commands);
+				else broadphase.Insert(motes.handle[j], PathBox(j, remaining(j, s + 1)));
+				ci.r = motes.radius[i];
+				changed = true;
+			}
+			PROFILE_LAP(laps, PROF_NARROWPHASE);
+			if (motes.radius[i] < MIN_RADIUS) {
+				Kill(i, commands);
+				return;
+			}
+			//otherwise the box of the step still holds the mote
+			if (changed) broadphase.Insert(hi, motes.GetAABB(i));
+			PROFILE_LAP(laps, PROF_REINSERT);
+		};
+		if (last) {
+			for (uint32_t i = 0; i < n; i++)
+				test(i);
+		} else {
+			for (int l = lowest(s + 1); l <= levels; l++)
+				for (uint32_t i : level_motes[l])
+					test(i);
+		}
+	}
+	PROFILE_SCOPE(PROF_COMMANDS);
+	ApplyCommands();
+}
+
+
+//the rest of BasicGame is instantiated in game.cpp
+#define INSTANTIATE_BLOCKS(BroadPhase) \
+	template vec2 BasicGame<BroadPhase>::Pull(uint32_t); \
+	template void BasicGame<BroadPhase>::React(uint32_t, float); \
+	template int BasicGame<BroadPhase>::BlockLevel(uint32_t, const vec2&, const float&, int) const; \
+	template AABB BasicGame<BroadPhase>::PathBox(uint32_t, float) const; \
+	template float BasicGame<BroadPhase>::ApproachTime(uint32_t, const Candidates&, float) const; \
+	template void BasicGame<BroadPhase>::UpdateBlocks(const sim_params&, const float&)
+
+INSTANTIATE_BLOCKS(GridBroadPhase);
+INSTANTIATE_BLOCKS(SapBroadPhase);
@@ -0,0 +1,250 @@
+#include "game.hpp"
+#include "collision.hpp"
+#include "gravity.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+//Coasting
+//Far from everything else a mote only feels the attractor, so its path is a Kepler orbit that can
+//be written down instead of integrated. A mote whose cells are empty gets its orbit and the box of
+//the path it takes in the next COAST_STEPS. If no other id is in the cells of that box it coasts:
+//the box goes into the broad-phase and its row moves behind awake, out of the attraction, the
+//integration and the step's loop. Nothing moves it until a test finds it as a candidate, its coast
+//ends or it is drawn, then Place() reads where it is off the orbit. Whatever enters the box later
+//finds it there and tests it as usual, a collision wakes it. Two coasting boxes never share a cell,
+//so coasting motes never have to be tested against each other.
+//All orbits move along one track, the line the attractor was on as they were fitted, so each step
+//only checks the attractor. Once it strays off the line or its mass drifts enough to move an orbit
+//by half of COAST_TOLERANCE, every orbit is refitted from where its mote is. A coasting mote pulls
+//the attractor as much as the attractor pulls it, the attractor gets all of it as the mote wakes.
+//The split rolls of the coming steps are known, so a coast ends at the first one that splits.
+//A try costs about as much as a few coasted steps save, so a mote that fails to coast or is woken
+//early waits twice as long before its next try, COAST_MIN_WAIT to COAST_MAX_WAIT steps, and one
+//that coasts the whole way halves its wait. Motes in a crowd soon stop trying.
+
+
+template <typename BroadPhase>
+bool BasicGame<BroadPhase>::CanCoast(const sim_params& param) const {
+	return param.kepler && param.threads <= 1 && param.block_levels <= 0 && !param.nbody_gravity && attractors.size() == 1;
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::UpdateCoasting(void) {
+	std::vector<Handle>& due = coast_due[step % (COAST_STEPS + 1)];
+	if (coast.size() > 0) {
+		const int64_t a = motes.Find(track.attractor);
+		const vec2 ap = motes.Pos(a), av = motes.Vel(a);
+		const float mu = GRAVITY_CONSTANT * motes.radius[a] * motes.radius[a];
+		const vec2 center = track.center + track.frame * static_cast<float>(time - track.epoch);
+		if ((ap - center).length2() > track.stray * track.stray || fabsf(mu - track.mu) > track.mu_slack) {
+			//every mote where the old track has it, then onto the new one
+			PlaceCoasting();
+			track.center = ap;
+			track.frame = av;
+			track.epoch = time;
+			track.mu = mu;
+			track.stray = track.mu_slack = std::numeric_limits<float>::infinity();
+			const float span = COAST_STEPS * track.dt;
+			for (uint32_t i = awake; i < motes.size(); i++) {
+				const Handle h = motes.handle[i];
+				coast_state* c = coast.Find(h);
+				if (c == nullptr) continue;
+				if (!KeplerOrbit(motes.Pos(i) - ap, motes.Vel(i) - av, mu, c->orbit)) {
+					Wake(h, step);
+					continue;
+				}
+				c->epoch = time;
+				//the rest of the path has to stay in the box
+				const float left = (c->wake - step) * track.dt;
+				const AABB arc = KeplerArcBounds(c->orbit, 0, left);
+				const vec2 drift = av * left;
+				const float r = motes.radius[i];
+				const AABB path(
+					ap.x + arc.A.x + std::min(drift.x, 0.f) - r, ap.y + arc.A.y + std::min(drift.y, 0.f) - r,
+					ap.x + arc.B.x + std::max(drift.x, 0.f) + r, ap.y + arc.B.y + std::max(drift.y, 0.f) + r
+				);
+				if (!path.inside(c->box)) {
+					Wake(h, step);
+					continue;
+				}
+				const float periapsis = c->orbit.a * (1 - c->orbit.e);
+				track.stray = std::min(track.stray, 0.5f * COAST_TOLERANCE * r);
+				track.mu_slack = std::min(track.mu_slack, COAST_TOLERANCE * r * periapsis * periapsis / (span * span));
+			}
+		}
+		for (Handle h : due)
+			if (const coast_state* c = coast.Find(h); c != nullptr && c->wake == step) Wake(h, step);
+	}
+	due.clear();
+	Regroup();
+}
+
+template <typename BroadPhase>
+bool BasicGame<BroadPhase>::CoastDue(Handle h) const {
+	const coast_backoff* b = backoff.Find(h);
+	return b == nullptr || step >= b->next;
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::Backoff(Handle h) {
+	coast_backoff& b = backoff[h];
+	b.wait = std::clamp(2 * b.wait, static_cast<uint32_t>(COAST_MIN_WAIT), static_cast<uint32_t>(COAST_MAX_WAIT));
+	b.next = step + b.wait;
+}
+
+template <typename BroadPhase>
+bool BasicGame<BroadPhase>::TryCoast(uint32_t i, const float& dt, const sim_params& param) {
+	const Handle h = motes.handle[i];
+	auto fail = [&]() {
+		Backoff(h);
+		return false;
+	};
+	const int64_t a = motes.Find(attractors.front());
+	if (a == i) return fail();
+	const float mu = GRAVITY_CONSTANT * motes.radius[a] * motes.radius[a];
+	//the first coasting mote lays the track
+	if (coast.size() == 0) {
+		track.attractor = attractors.front();
+		track.center = motes.Pos(a);
+		track.frame = motes.Vel(a);
+		track.epoch = time;
+		track.mu = mu;
+		track.stray = track.mu_slack = std::numeric_limits<float>::infinity();
+		track.dt = dt;
+		track.splitting = param.allow_splitting;
+	}
+	const vec2 ap = track.center + track.frame * static_cast<float>(time - track.epoch), av = track.frame;
+	coast_state s;
+	if (!KeplerOrbit(motes.Pos(i) - ap, motes.Vel(i) - av, track.mu, s.orbit)) return fail();
+	
+	//the path around where the attractor is now and where it drifts to, the margin leaves room for
+	//the mote itself and for the attractor to speed up a little
+	const float span = COAST_STEPS * dt;
+	const AABB arc = KeplerArcBounds(s.orbit, 0, span);
+	const vec2 drift = av * span;
+	const float m = 2 * motes.radius[i];
+	s.box = AABB(
+		ap.x + arc.A.x + std::min(drift.x, 0.f) - m, ap.y + arc.A.y + std::min(drift.y, 0.f) - m,
+		ap.x + arc.B.x + std::max(drift.x, 0.f) + m, ap.y + arc.B.y + std::max(drift.y, 0.f) + m
+	);
+	//every corner inside the surface keeps the whole path off it
+	const float x = std::max(fabsf(s.box.A.x), fabsf(s.box.B.x));
+	const float y = std::max(fabsf(s.box.A.y), fabsf(s.box.B.y));
+	const float surface = std::min(bounds.B.x, bounds.B.y);
+	if (x*x + y*y > surface * surface) return fail();
+	
+	//the coast ends at the first split roll that splits the mote, the cooldown runs out as if it
+	//were stepped
+	s.wake = step + COAST_STEPS;
+	float cooldown = motes.split_cooldown[i];
+	const float chance = SplitChance(i, dt);
+	for (uint64_t k = step + 1; k < s.wake; k++) {
+		if (cooldown > 0) cooldown -= dt;
+		else if (param.allow_splitting && SplitRoll(i, k) <= chance) s.wake = k;
+	}
+	if (s.wake <= step + 1) return fail();
+	
+	bool alone = true;
+	broadphase.GetInside(s.box, [&](Handle other) {
+		if (other == h) return;
+		const int64_t j = motes.Find(other);
+		if (j >= 0 && motes.radius[j] >= 0) alone = false;
+	});
+	if (!alone) return fail();
+	
+	s.epoch = s.placed = time;
+	s.since = step + 1;
+	s.vel = motes.Vel(i);
+	coast[h] = s;
+	coast_due[s.wake % (COAST_STEPS + 1)].push_back(h);
+	regroup.push_back(h);
+	broadphase.Insert(h, s.box);
+	const float r = motes.radius[i];
+	const float periapsis = s.orbit.a * (1 - s.orbit.e);
+	track.stray = std::min(track.stray, 0.5f * COAST_TOLERANCE * r);
+	track.mu_slack = std::min(track.mu_slack, COAST_TOLERANCE * r * periapsis * periapsis / (span * span));
+	return true;
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::Place(uint32_t i) {
+	coast_state* c = coast.Find(motes.handle[i]);
+	if (c == nullptr || c->placed == time) return;
+	c->placed = time;
+	const vec2 center = track.center + track.frame * static_cast<float>(time - track.epoch);
+	vec2 r, v;
+	KeplerState(c->orbit, time - c->epoch, r, v);
+	motes.SetPos(i, center + r);
+	motes.SetVel(i, track.frame + v);
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::PlaceCoasting(void) {
+	for (uint32_t i = awake; i < motes.size(); i++)
+		Place(i);
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::Wake(Handle h, uint64_t next) {
+	const coast_state* c = coast.Find(h);
+	if (c == nullptr) return;
+	const int64_t i = motes.Find(h);
+	if (i >= 0) {
+		Place(i);
+		//the attractor's share of the momentum the orbit moved around, m_i / m_a of the mote's
+		const int64_t a = motes.Find(track.attractor);
+		if (a >= 0 && motes.radius[a] > 0) {
+			const float k = (motes.radius[i] * motes.radius[i]) / (motes.radius[a] * motes.radius[a]);
+			motes.SetVel(a, motes.Vel(a) - (motes.Vel(i) - c->vel) * k);
+		}
+		for (uint64_t s = c->since; s < next && motes.split_cooldown[i] > 0; s++)
+			motes.split_cooldown[i] -= track.dt;
+		if (motes.radius[i] > 0) broadphase.Insert(h, motes.GetAABB(i));
+	}
+	//a coast cut short cost more than it saved, one that ran its course earns quicker tries
+	if (step < c->wake) Backoff(h);
+	else if (coast_backoff* b = backoff.Find(h)) b->wait /= 2, b->next = step;
+	coast.Erase(h);
+	regroup.push_back(h);
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::WakeAll(void) {
+	for (uint32_t i = awake; i < motes.size(); i++)
+		Wake(motes.handle[i], step);
+	Regroup();
+	for (std::vector<Handle>& due : coast_due) due.clear();
+	backoff.clear(); //tries start afresh once coasting is back on
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::Regroup(void) {
+	for (Handle h : regroup) {
+		const int64_t i = motes.Find(h);
+		if (i < 0) continue;
+		const bool coasting = coast.Find(h) != nullptr;
+		if (coasting && i < awake) motes.Swap(i, --awake);
+		else if (!coasting && i >= awake) motes.Swap(i, awake++);
+	}
+	regroup.clear();
+}
+
+
+//the rest of BasicGame is instantiated in game.cpp
+#define INSTANTIATE_COAST(BroadPhase) \
+	template bool BasicGame<BroadPhase>::CanCoast(const sim_params&) const; \
+	template void BasicGame<BroadPhase>::UpdateCoasting(void); \
+	template bool BasicGame<BroadPhase>::TryCoast(uint32_t, const float&, const sim_params&); \
+	template bool BasicGame<BroadPhase>::CoastDue(Handle) const; \
+	template void BasicGame<BroadPhase>::Backoff(Handle); \
+	template void BasicGame<BroadPhase>::Place(uint32_t); \
+	template void BasicGame<BroadPhase>::PlaceCoasting(void); \
+	template void BasicGame<BroadPhase>::Wake(Handle, uint64_t); \
+	template void BasicGame<BroadPhase>::WakeAll(void); \
+	template void BasicGame<BroadPhase>::Regroup(void)
+
+INSTANTIATE_COAST(GridBroadPhase);
+INSTANTIATE_COAST(SapBroadPhase);
@@ -0,0 +1,212 @@
+#include "game.hpp"
+#include "collision.hpp"
+#include "profile.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+//Parallel step
+//Integration, attraction and surface collisions are independent per mote and run in chunks.
+//Collisions are found in parallel on a read-only grid, then split into islands of motes that
+//touch each other. Islands share no motes, so each one is resolved by a single thread.
+//Work is split into fixed size chunks and merged in chunk order, so in deterministic mode the
+//result does not depend on the amount of threads.
+
+
+template <typename BroadPhase>
+ThreadPool* BasicGame<BroadPhase>::GetPool(int threads) {
+	if (pool == nullptr || pool->Size() != threads)
+		pool = std::make_unique<ThreadPool>(threads);
+	return pool.get();
+}
+
+template <typename BroadPhase>
+size_t BasicGame<BroadPhase>::ChunkSize(const sim_params& param, size_t n) const {
+	if (param.deterministic) return PARALLEL_CHUNK;
+	return std::max(PARALLEL_CHUNK, n / (4 * param.threads) + 1);
+}
+
+template <typename BroadPhase>
+uint32_t BasicGame<BroadPhase>::FindIsland(uint32_t i) {
+	while (island_parent[i] != i) {
+		island_parent[i] = island_parent[island_parent[i]];
+		i = island_parent[i];
+	}
+	return i;
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::DetectCollisions(ThreadPool* pool, size_t chunk) {
+	const size_t n = motes.size();
+	const size_t chunks = (n + chunk - 1) / chunk;
+	if (chunk_pairs.size() < chunks) chunk_pairs.resize(chunks);
+	if (chunk_candidates.size() < chunks) chunk_candidates.resize(chunks);
+	
+	ParallelFor(pool, n, chunk, [&](size_t begin, size_t end, size_t c) {
+		std::vector<std::pair<uint32_t, uint32_t>>& out = chunk_pairs[c];
+		Candidates& cand = chunk_candidates[c];
+		out.clear();
+		for (size_t i = begin; i < end; i++) {
+			const Circle ci = motes.GetCircle(i);
+			const float travel = Travel(i);
+			GatherCandidates(i, true, cand); //each pair is found from both sides
+			for (size_t k = 0;; k++) {
+				k = simd_first_overlap(ci.pos.x, ci.pos.y, ci.r + travel, cand.x.data(), cand.y.data(), cand.r.data(),
+					k, cand.size());
+				if (k == cand.size()) break;
+				float d;
+				if (sweep && !Touching(i, cand.index[k], d)) continue;
+				out.push_back({i, cand.index[k]});
+			}
+		}
+	});
+	
+	pairs.clear();
+	for (size_t c = 0; c < chunks; c++)
+		pairs.insert(pairs.end(), chunk_pairs[c].begin(), chunk_pairs[c].end());
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::ResolveCollisions(ThreadPool* pool) {
+	const size_t n = motes.size();
+	
+	//union-find, the lower index always becomes the root
+	island_parent.resize(n);
+	std::iota(island_parent.begin(), island_parent.end(), 0);
+	for (const auto& [i, j] : pairs) {
+		const uint32_t a = FindIsland(i), b = FindIsland(j);
+		if (a < b) island_parent[b] = a;
+		else if (b < a) island_parent[a] = b;
+	}
+	
+	//group pairs by island, keeping their order inside each island
+	island_id.assign(n, UINT32_MAX);
+	island_start.clear();
+	pair_island.resize(pairs.size());
+	for (size_t p = 0; p < pairs.size(); p++) {
+		uint32_t& id = island_id[FindIsland(pairs[p].first)];
+		if (id == UINT32_MAX) {
+			id = island_start.size();
+			island_start.push_back(0);
+		}
+		island_start[id]++;
+		pair_island[p] = id;
+	}
+	const size_t islands = island_start.size();
+	uint32_t sum = 0;
+	for (uint32_t& s : island_start) {
+		const uint32_t count = s;
+		s = sum;
+		sum += count;
+	}
+	island_start.push_back(sum);
+	island_fill.assign(island_start.begin(), island_start.end() - 1);
+	island_pairs.resize(pairs.size());
+	for (size_t p = 0; p < pairs.size(); p++)
+		island_pairs[island_fill[pair_island[p]]++] = p;
+	
+	ParallelFor(pool, islands, 16, [&](size_t begin, size_t end, size_t) {
+		for (size_t k = begin; k < end; k++)
+			for (uint32_t o = island_start[k]; o < island_start[k+1]; o++) {
+				const auto [i, j] = pairs[island_pairs[o]];
+				if (motes.radius[i] <= 0 || motes.radius[j] <= 0) continue;
+				//radii may have changed since detection
+				float d;
+				if (Touching(i, j, d))
+					CollideMotes(i, j, d);
+			}
+	});
+}
+
+template <typename BroadPhase>
+void BasicGame<BroadPhase>::UpdateParallel(const sim_params& param, const float& dt) {
+	ThreadPool* pool = GetPool(param.threads);
+	const size_t chunk = ChunkSize(param, motes.size());
+	
+	{
+		PROFILE_SCOPE(PROF_ATTRACT);
+		if (param.nbody_gravity) AttractAll(dt, param.bh_theta, pool, chunk);
+		else Attract(dt, pool, chunk);
+	}
+	{
+		PROFILE_SCOPE(PROF_INTEGRATE);
+		Integrate(dt, pool, chunk);
+	}
+	{
+		PROFILE_SCOPE(PROF_SURFACE);
+		ParallelFor(pool, motes.size(), chunk, [&](size_t begin, size_t end, size_t) {
+			for (size_t i = begin; i < end; i++) {
+				vec2 norm;
+				float dist;
+				if (CheckSurface(i, norm, dist))
+					CollideSurface(i, norm, dist);
+			}
+		});
+	}
+	
+	//splits only change their own mote, the children go into per chunk buffers
+	const size_t n = motes.size();
+	const size_t chunks = (n + chunk - 1) / chunk;
+	split_roll.resize(n);
+	if (chunk_commands.size() < chunks) chunk_commands.resize(chunks);
+	{
+		PROFILE_SCOPE(PROF_SPLIT);
+		ParallelFor(pool, n, chunk, [&](size_t begin, size_t end, size_t c) {
+			Commands& cmd = chunk_commands[c];
+			cmd.clear();
+			if (param.allow_splitting)
+				rng_floats(seed, &motes.id[begin], end - begin, step, RNG_SPLIT, &split_roll[begin]);
+			for (size_t i = begin; i < end; i++) {
+				const MoteAction act = UpdateSplit(i, param, dt, split_roll[i]);
+				if (act.IsSplitting()) Split(i, act, cmd);
+			}
+		});
+	}
+	
+	//the broad-phase has to be current and read-only while collisions are detected
+	{
+		PROFILE_SCOPE(PROF_REINSERT);
+		for (uint32_t i = 0; i < n; i++)
+			broadphase.Insert(motes.handle[i], MoteBox(i));
+	}
+	{
+		PROFILE_SCOPE(PROF_BROADPHASE);
+		DetectCollisions(pool, chunk);
+	}
+	{
+		PROFILE_SCOPE(PROF_NARROWPHASE);
+		ResolveCollisions(pool);
+	}
+	
+	//remove absorbed motes and move the ones that grew
+	{
+		PROFILE_SCOPE(PROF_REINSERT);
+		touched.assign(motes.size(), 0);
+		for (const auto& [i, j] : pairs)
+			for (uint32_t k : {i, j}) {
+				if (touched[k]) continue;
+				touched[k] = 1;
+				if (motes.radius[k] < MIN_RADIUS) Kill(k, commands);
+				else broadphase.Insert(motes.handle[k], MoteBox(k));
+			}
+	}
+	PROFILE_SCOPE(PROF_COMMANDS);
+	for (size_t c = 0; c < chunks; c++)
+		commands.spawn.insert(commands.spawn.end(), chunk_commands[c].spawn.begin(), chunk_commands[c].spawn.end());
+	ApplyCommands();
+}
+
+
+//the rest of BasicGame is instantiated in game.cpp
+#define INSTANTIATE_PARALLEL(BroadPhase) \
+	template ThreadPool* BasicGame<BroadPhase>::GetPool(int); \
+	template size_t BasicGame<BroadPhase>::ChunkSize(const sim_params&, size_t) const; \
+	template uint32_t BasicGame<BroadPhase>::FindIsland(uint32_t); \
+	template void BasicGame<BroadPhase>::DetectCollisions(ThreadPool*, size_t); \
+	template void BasicGame<BroadPhase>::ResolveCollisions(ThreadPool*); \
+	template void BasicGame<BroadPhase>::UpdateParallel(const sim_params&, const float&)
+
+INSTANTIATE_PARALLEL(GridBroadPhase);
+INSTANTIATE_PARALLEL(SapBroadPhase);
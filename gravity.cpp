@@ -0,0 +1,218 @@
+#include "gravity.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+MassTree::MassTree(AABB bb, int depth) : bounds(bb), depth(-1) {
+	SetDepth(depth);
+}
+
+void MassTree::SetDepth(int d) {
+	if (d == depth) return;
+	depth = d;
+	levels.assign(depth+1, {});
+	for (int l = 0; l <= depth; l++)
+		levels[l].resize(1 << (2*l));
+	leaf_start.assign((1 << (2*depth)) + 1, 0);
+}
+
+int MassTree::LeafOf(float x, float y) const {
+	const int w = 1 << depth;
+	const vec2 s = bounds.B - bounds.A;
+	const int cx = std::min(std::max(static_cast<int>((x - bounds.A.x) / s.x * w), 0), w-1);
+	const int cy = std::min(std::max(static_cast<int>((y - bounds.A.y) / s.y * w), 0), w-1);
+	return cy * w + cx;
+}
+
+size_t MassTree::Bytes(void) const {
+	size_t n = VectorBytes(leaf_start) + VectorBytes(body) + VectorBytes(bx) + VectorBytes(by) + VectorBytes(bm) +
+		VectorBytes(leaf) + VectorBytes(fill);
+	for (const std::vector<Node>& l : levels) n += VectorBytes(l);
+	return n;
+}
+
+void MassTree::Build(const float* px, const float* py, const float* mass, size_t n) {
+	const int leaves = 1 << (2*depth);
+	
+	//counting sort bodies by leaf
+	std::fill(leaf_start.begin(), leaf_start.end(), 0);
+	leaf.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		leaf[i] = LeafOf(px[i], py[i]);
+		leaf_start[leaf[i] + 1]++;
+	}
+	for (int i = 0; i < leaves; i++)
+		leaf_start[i+1] += leaf_start[i];
+	
+	body.resize(n), bx.resize(n), by.resize(n), bm.resize(n);
+	fill.assign(leaf_start.begin(), leaf_start.end() - 1);
+	for (size_t i = 0; i < n; i++) {
+		const uint32_t o = fill[leaf[i]]++;
+		body[o] = i;
+		bx[o] = px[i], by[o] = py[i], bm[o] = mass[i];
+	}
+	
+	//leaf aggregates
+	std::vector<Node>& bottom = levels[depth];
+	for (int c = 0; c < leaves; c++) {
+		Node nd = {0, 0, 0};
+		for (uint32_t o = leaf_start[c]; o < leaf_start[c+1]; o++) {
+			nd.mass += bm[o];
+			nd.cx += bx[o] * bm[o];
+			nd.cy += by[o] * bm[o];
+		}
+		bottom[c] = nd;
+	}
+	
+	//sum children upwards, centers stay mass weighted until the end
+	for (int d = depth - 1; d >= 0; d--) {
+		const int w = 1 << d;
+		const std::vector<Node>& below = levels[d+1];
+		for (int y = 0; y < w; y++)
+			for (int x = 0; x < w; x++) {
+				Node nd = {0, 0, 0};
+				for (int i = 2*y; i <= 2*y+1; i++)
+					for (int j = 2*x; j <= 2*x+1; j++) {
+						const Node& c = below[i * 2*w + j];
+						nd.mass += c.mass, nd.cx += c.cx, nd.cy += c.cy;
+					}
+				levels[d][y * w + x] = nd;
+			}
+	}
+	for (auto& level : levels)
+		for (Node& nd : level)
+			if (nd.mass > 0) nd.cx /= nd.mass, nd.cy /= nd.mass;
+}
+
+vec2 MassTree::Accel(uint32_t i, float x, float y, float theta, float softening) const {
+	struct Visit { int x, y, d; };
+	Visit stack[4 * 16 + 4];
+	int top = 0;
+	stack[top++] = {0, 0, 0};
+	
+	const float soft2 = softening * softening;
+	const vec2 size = bounds.B - bounds.A;
+	float ax = 0, ay = 0;
+	
+	while (top > 0) {
+		const Visit v = stack[--top];
+		const int w = 1 << v.d;
+		const Node& nd = levels[v.d][v.y * w + v.x];
+		if (nd.mass <= 0) continue;
+		
+		if (v.d == depth) {
+			//leaf, sum bodies directly
+			const int c = v.y * w + v.x;
+			for (uint32_t o = leaf_start[c]; o < leaf_start[c+1]; o++) {
+				if (body[o] == i) continue;
+				const float dx = bx[o] - x, dy = by[o] - y;
+				const float dist2 = dx*dx + dy*dy + soft2;
+				const float k = bm[o] / (sqrtf(dist2) * dist2);
+				ax += dx * k, ay += dy * k;
+			}
+			continue;
+		}
+		
+		const float dx = nd.cx - x, dy = nd.cy - y;
+		const float dist2 = dx*dx + dy*dy + soft2;
+		const float s = std::max(size.x, size.y) / w;
+		const float cell_x = bounds.A.x + size.x * v.x / w;
+		const float cell_y = bounds.A.y + size.y * v.y / w;
+		const bool inside = x >= cell_x && y >= cell_y && x < cell_x + size.x / w && y < cell_y + size.y / w;
+		if (!inside && s * s < theta * theta * dist2) {
+			//far enough, use the aggregate
+			const float k = nd.mass / (sqrtf(dist2) * dist2);
+			ax += dx * k, ay += dy * k;
+			continue;
+		}
+		for (int cy = 2*v.y; cy <= 2*v.y+1; cy++)
+			for (int cx = 2*v.x; cx <= 2*v.x+1; cx++)
+				stack[top++] = {cx, cy, v.d + 1};
+	}
+	return vec2(ax, ay);
+}
+
+void DirectGravity(const float* px, const float* py, const float* mass, size_t n,
+	float softening, float* ax, float* ay) {
+	const float soft2 = softening * softening;
+	for (size_t i = 0; i < n; i++) {
+		float sx = 0, sy = 0;
+		for (size_t j = 0; j < n; j++) {
+			if (i == j) continue;
+			const float dx = px[j] - px[i], dy = py[j] - py[i];
+			const float dist2 = dx*dx + dy*dy + soft2;
+			const float k = mass[j] / (sqrtf(dist2) * dist2);
+			sx += dx * k, sy += dy * k;
+		}
+		ax[i] = sx, ay[i] = sy;
+	}
+}
+
+
+bool KeplerOrbit(const vec2& r, const vec2& v, float mu, kepler_orbit& o) {
+	const float d = r.length();
+	const float v2 = v.length2();
+	const float energy = 0.5f * v2 - mu / d;
+	if (!(d > 0) || !(energy < 0)) return false;
+	//eccentricity vector, points at the closest approach
+	const vec2 ev = (r * (v2 - mu / d) - v * r.dot(v)) / mu;
+	o.e = ev.length();
+	if (o.e > KEPLER_MAX_ECCENTRICITY) return false;
+	o.a = -mu / (2 * energy);
+	o.n = sqrtf(mu / (o.a * o.a * o.a));
+	//a circle has no closest approach, the epoch is as good as any point
+	o.P = o.e > 1e-6f ? ev / o.e : r / d;
+	const bool ccw = r.x * v.y - r.y * v.x >= 0;
+	o.Q = ccw ? vec2(-o.P.y, o.P.x) : vec2(o.P.y, -o.P.x);
+	const float b = o.a * sqrtf(1 - o.e * o.e);
+	o.E = atan2f(r.dot(o.Q) / b, r.dot(o.P) / o.a + o.e);
+	o.M0 = o.E - o.e * sinf(o.E);
+	return true;
+}
+
+//eccentric anomaly for mean anomaly M by Newton's method from o.E, s and c are its sine and cosine
+//the last correction is below 1e-6 and not applied to them
+static float SolveKepler(const kepler_orbit& o, float M, float& s, float& c) {
+	float E = o.E;
+	for (int k = 0; k < 8; k++) {
+		s = sinf(E), c = cosf(E);
+		const float dE = (E - o.e * s - M) / (1 - o.e * c);
+		E -= dE;
+		if (fabsf(dE) < 1e-6f) break;
+	}
+	return E;
+}
+
+static vec2 KeplerPos(const kepler_orbit& o, float s, float c) {
+	return o.P * (o.a * (c - o.e)) + o.Q * (o.a * sqrtf(1 - o.e * o.e) * s);
+}
+
+void KeplerState(kepler_orbit& o, float t, vec2& r, vec2& v) {
+	float s, c;
+	o.E = SolveKepler(o, o.M0 + o.n * t, s, c);
+	const float k = sqrtf(1 - o.e * o.e);
+	r = o.P * (o.a * (c - o.e)) + o.Q * (o.a * k * s);
+	v = (o.P * -s + o.Q * (k * c)) * (o.a * o.n / (1 - o.e * c));
+}
+
+AABB KeplerArcBounds(const kepler_orbit& o, float t0, float t1) {
+	float s, c;
+	const float E0 = SolveKepler(o, o.M0 + o.n * t0, s, c);
+	const vec2 start = KeplerPos(o, s, c);
+	const float E1 = SolveKepler(o, o.M0 + o.n * t1, s, c);
+	vec2 lo = KeplerPos(o, s, c), hi = lo;
+	lo.x = std::min(lo.x, start.x), lo.y = std::min(lo.y, start.y);
+	hi.x = std::max(hi.x, start.x), hi.y = std::max(hi.y, start.y);
+	//short arcs are about straight, longer ones get sampled every 0.1 radians
+	const int segments = std::max(1, static_cast<int>(ceilf(fabsf(E1 - E0) * 10)));
+	const float step = (E1 - E0) / segments;
+	for (int k = 1; k < segments; k++) {
+		const float E = E0 + step * k;
+		const vec2 p = KeplerPos(o, sinf(E), cosf(E));
+		lo.x = std::min(lo.x, p.x), lo.y = std::min(lo.y, p.y);
+		hi.x = std::max(hi.x, p.x), hi.y = std::max(hi.y, p.y);
+	}
+	//the arc bulges at most a * step^2 / 8 past the chords between the samples
+	const float bulge = o.a * step * step / 8;
+	return AABB(lo.x - bulge, lo.y - bulge, hi.x + bulge, hi.y + bulge);
+}
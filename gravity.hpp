@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "common.hpp"
+#include "collision.hpp"
+
+
+//mass and center of mass aggregates laid out like the levels of a Grid,
+//used for O(N log N) Barnes-Hut gravity between all motes
+class MassTree {
+	struct Node {
+		float mass;
+		float cx, cy; //center of mass
+	};
+	
+	AABB bounds;
+	int depth;
+	std::vector<std::vector<Node>> levels; //level d holds (1 << d)^2 cells, row major
+	//bodies sorted by leaf cell, leaf i owns [leaf_start[i], leaf_start[i+1])
+	std::vector<uint32_t> leaf_start;
+	std::vector<uint32_t> body; //original index
+	std::vector<float> bx, by, bm;
+	std::vector<uint32_t> leaf, fill; //build scratch
+	
+	int LeafOf(float x, float y) const;
+	
+public:
+	MassTree(AABB bb, int depth);
+	
+	int GetDepth(void) const { return depth; }
+	//levels below the root, the aggregates are rebuilt by the next Build()
+	void SetDepth(int d);
+	
+	//rebuilds all aggregates, bodies outside the bounds are clamped into the edge cells
+	void Build(const float* px, const float* py, const float* mass, size_t n);
+	
+	//gravitational acceleration (without G) on body i at (x, y)
+	//cells whose size / distance is below theta are treated as one body
+	vec2 Accel(uint32_t i, float x, float y, float theta, float softening) const;
+	
+	float TotalMass(void) const { return levels[0][0].mass; }
+	//memory held by the aggregates and the sorted bodies
+	size_t Bytes(void) const;
+};
+
+//O(N^2) reference, writes the acceleration (without G) of every body into ax, ay
+void DirectGravity(const float* px, const float* py, const float* mass, size_t n,
+	float softening, float* ax, float* ay);
+
+//bound two-body orbit around a center that pulls with mu / dist^2, in closed form
+//positions and velocities are relative to the center, times are seconds after the epoch
+struct kepler_orbit {
+	vec2 P, Q; //unit vectors towards the closest approach and a quarter turn further along the motion
+	float a, e; //semi-major axis, eccentricity
+	float n; //mean motion, radians per second
+	float M0; //mean anomaly at the epoch
+	float E; //eccentric anomaly of the last KeplerState(), where the next solve starts
+};
+
+constexpr float KEPLER_MAX_ECCENTRICITY = 0.95; //closer to a parabola the solve loses too much precision
+
+//orbit through position r with velocity v, false if it isn't bound or too eccentric
+bool KeplerOrbit(const vec2& r, const vec2& v, float mu, kepler_orbit& o);
+//position and velocity t seconds after the epoch
+void KeplerState(kepler_orbit& o, float t, vec2& r, vec2& v);
+//box around the path between t0 and t1 seconds after the epoch
+AABB KeplerArcBounds(const kepler_orbit& o, float t0, float t1);
@@ -0,0 +1,226 @@
+#include "game.hpp"
+#include "profile.hpp"
+#include "recorder.hpp"
+#include "snapshot.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+//defaults
+#define DEFAULT_STEPS 1000
+#define DEFAULT_DT (1. / 60)
+#define WORLD_SIZE 20
+
+static void usage(const char* name) {
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -n <steps>   number of fixed steps to run (default %d)\n"
+		"  -dt <sec>    step size in simulated seconds (default %g)\n"
+		"  -m <motes>   scatter this many motes in orbit around the attractor\n"
+		"  -r <seed>    seed of the run, reproduces it exactly\n"
+		"  -s           allow splitting\n"
+		"  -g           gravity between all motes (Barnes-Hut)\n"
+		"  -theta <a>   Barnes-Hut opening angle (default 0.5)\n"
+		"  -t <threads> worker threads, 1 runs the serial reference step (default 1)\n"
+		"  -f           let parallel results depend on the thread count (faster)\n"
+		"  -ccd         swept collisions, fast motes can't pass through others with large -dt\n"
+		"  -blocks <n>  block steps, motes step down to dt / 2^n as they need, 0 to %d (default 0)\n"
+		"  -kepler      isolated motes coast along their orbits without collision tests\n"
+		"  -l <file>    start from a snapshot, its seed replaces -r\n"
+		"  -o <file>    save a snapshot after the last step\n"
+		"  -rec <file>  record the trajectory of the run\n"
+		"  -k <steps>   steps between keyframes of the recording (default 600)\n"
+		"  -w <size>    half the width of the world (default %d), a loaded snapshot brings its own\n"
+		"  -d <depth>   grid levels below the root, 0 to %d (default %d)\n"
+		"  -auto        retune the grid depth while running\n"
+		"  -loose <x>   grid looseness, motes are placed by their box scaled by x (default 1)\n"
+		"  -prof <file> per phase timings of every step as CSV (needs make PROFILE=1)\n",
+		name, DEFAULT_STEPS, DEFAULT_DT, MAX_BLOCK_LEVELS, WORLD_SIZE, GRID_MAX_DEPTH, GRID_DEPTH);
+}
+
+static double seconds_since(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+#ifdef OSMOSIM_PROFILE
+static void PrintProfile(void) {
+	const profile_stats* total = profile_total();
+	const uint64_t steps = profile_steps();
+	double sum = 0;
+	for (int p = 0; p < PROF_PHASES; p++) sum += total[p].seconds;
+	printf("\n%-12s %10s %8s %7s %12s %10s\n", "phase", "total ms", "ms/step", "share", "calls", "allocs");
+	for (int p = 0; p < PROF_PHASES; p++) {
+		const profile_stats& s = total[p];
+		printf("%-12s %10.2f %8.4f %6.1f%% %12llu %10llu\n", profile_name(static_cast<profile_phase>(p)),
+			s.seconds * 1e3, steps > 0 ? s.seconds * 1e3 / steps : 0., sum > 0 ? 100 * s.seconds / sum : 0.,
+			static_cast<unsigned long long>(s.calls), static_cast<unsigned long long>(s.allocs));
+	}
+}
+#endif
+
+//places motes on circular orbits in a ring around the central attractor
+static void ScatterMotes(Game& g, int amount, uint64_t seed) {
+	if (amount <= 0) return;
+	const std::vector<Handle>& attractors = g.GetAttractors();
+	const std::optional<Mote> attractor = attractors.empty() ? std::nullopt : g.GetMote(attractors.front());
+	if (!attractor) {
+		fprintf(stderr, "the attractor is gone, no motes scattered\n");
+		return;
+	}
+	const Mote a = *attractor;
+	const float mass = a.radius * a.radius;
+	const vec2 half = (g.bounds.B - g.bounds.A) * 0.5;
+	const float inner = a.radius * 2, outer = std::min(half.x, half.y) * 0.9;
+	for (int i = 0; i < amount; i++) {
+		const rng_block r = rng_philox(seed, i, 0, RNG_SCATTER);
+		const float d = inner + (outer - inner) * rng_unit(r.v[0]);
+		const float q = 2*M_PI * rng_unit(r.v[1]);
+		const vec2 dir(cos(q), sin(q));
+		Mote m(a.pos + dir * d, 0.005 + 0.025 * rng_unit(r.v[2]));
+		m.vel = vec2(-dir.y, dir.x) * sqrtf(GRAVITY_CONSTANT * mass / d);
+		g.AddMote(m);
+	}
+}
+
+int main(int argc, char** argv) {
+	int steps = DEFAULT_STEPS;
+	float dt = DEFAULT_DT;
+	int scatter = 0;
+	uint64_t seed = 1;
+	const char* load_path = nullptr;
+	const char* save_path = nullptr;
+	const char* rec_path = nullptr;
+	const char* prof_path = nullptr;
+	trajectory_header rec_header;
+	float looseness = 1;
+	float world_size = WORLD_SIZE;
+	int depth = GRID_DEPTH;
+	debug_log log;
+	sim_params param(log);
+	
+	for (int i = 1; i < argc; i++) {
+		const bool has_val = i + 1 < argc;
+		if (!strcmp(argv[i], "-n") && has_val) steps = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-dt") && has_val) dt = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-m") && has_val) scatter = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-r") && has_val) seed = strtoull(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "-s")) param.allow_splitting = true;
+		else if (!strcmp(argv[i], "-g")) param.nbody_gravity = true;
+		else if (!strcmp(argv[i], "-theta") && has_val) param.bh_theta = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-t") && has_val) param.threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-f")) param.deterministic = false;
+		else if (!strcmp(argv[i], "-ccd")) param.swept = true;
+		else if (!strcmp(argv[i], "-blocks") && has_val) param.block_levels = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-kepler")) param.kepler = true;
+		else if (!strcmp(argv[i], "-l") && has_val) load_path = argv[++i];
+		else if (!strcmp(argv[i], "-o") && has_val) save_path = argv[++i];
+		else if (!strcmp(argv[i], "-rec") && has_val) rec_path = argv[++i];
+		else if (!strcmp(argv[i], "-k") && has_val) rec_header.keyframe_interval = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-w") && has_val) world_size = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-d") && has_val) depth = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-auto")) param.auto_depth = true;
+		else if (!strcmp(argv[i], "-loose") && has_val) looseness = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-prof") && has_val) prof_path = argv[++i];
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	
+#ifndef OSMOSIM_PROFILE
+	if (prof_path != nullptr) {
+		fprintf(stderr, "-prof: built without profiling, rebuild with make clean && make PROFILE=1\n");
+		return 1;
+	}
+#else
+	if (prof_path != nullptr && !profile_open_csv(prof_path)) {
+		fprintf(stderr, "%s: could not create profile\n", prof_path);
+		return 1;
+	}
+#endif
+	
+	if (world_size <= 0 || depth < 0 || depth > GRID_MAX_DEPTH || param.block_levels < 0 || param.block_levels > MAX_BLOCK_LEVELS) {
+		usage(argv[0]);
+		return 1;
+	}
+	
+	AABB bounds({-world_size,-world_size}, {world_size,world_size});
+	Snapshot snap;
+	if (load_path != nullptr) {
+		if (!snap.Open(load_path)) {
+			fprintf(stderr, "%s: not a valid snapshot\n", load_path);
+			return 1;
+		}
+		bounds = snap.Bounds();
+	}
+	
+	Game g(bounds, seed, depth);
+	g.GetBroadPhase().SetLooseness(looseness);
+	if (snap.IsOpen()) {
+		const auto load_start = chrono::steady_clock::now();
+		g.Load(snap);
+		snap.Close();
+		printf("loaded:     %zu motes at step %llu in %.3f s\n", g.MoteCount(),
+			static_cast<unsigned long long>(g.GetStep()), seconds_since(load_start));
+	}
+	ScatterMotes(g, scatter, g.GetSeed());
+	
+	Recorder rec;
+	if (rec_path != nullptr) {
+		rec_header.seed = g.GetSeed();
+		if (!rec.Open(rec_path, rec_header)) {
+			fprintf(stderr, "%s: could not create recording\n", rec_path);
+			return 1;
+		}
+		rec.Capture(g.GetStep(), g.GetMotes()); //starting state
+		g.SetRecorder(&rec);
+	}
+	
+	const uint64_t updates = g.GetMoteUpdates();
+	const auto start = chrono::steady_clock::now();
+	g.Step(param, dt, steps);
+	const double elapsed = seconds_since(start);
+	g.SetRecorder(nullptr);
+	if (rec_path != nullptr && !rec.Close()) {
+		fprintf(stderr, "%s: writing the recording failed\n", rec_path);
+		return 1;
+	}
+#ifdef OSMOSIM_PROFILE
+	if (!profile_close_csv()) {
+		fprintf(stderr, "%s: writing the profile failed\n", prof_path);
+		return 1;
+	}
+#endif
+	
+	printf("steps:      %d\n", steps);
+	printf("time:       %.3f s\n", elapsed);
+	printf("steps/s:    %.1f\n", elapsed > 0 ? steps / elapsed : 0.);
+	printf("motes:      %zu\n", g.MoteCount());
+	printf("total area: %.9g\n", g.GetTotalArea());
+	printf("grid depth: %d\n", g.GetGridDepth());
+	const memory_stats mem = g.GetMemoryStats();
+	printf("memory:     %.2f MB, motes %.2f MB (peak %zu), grid %.2f MB, step buffers %.2f MB\n", mem.Bytes() / 1e6,
+		mem.motes.bytes / 1e6, mem.motes.peak, mem.broadphase.bytes / 1e6, mem.scratch / 1e6);
+	printf("unused:     motes %.0f%%, grid %.0f%%\n", mem.motes.Fragmentation() * 100, mem.broadphase.Fragmentation() * 100);
+	if (param.block_levels > 0 || param.kepler)
+		printf("updates:    %.1f per step\n", steps > 0 ? (g.GetMoteUpdates() - updates) / static_cast<double>(steps) : 0.);
+	
+	if (save_path != nullptr) {
+		const auto save_start = chrono::steady_clock::now();
+		if (!g.Save(save_path)) {
+			fprintf(stderr, "%s: could not write snapshot\n", save_path);
+			return 1;
+		}
+		printf("saved:      %s in %.3f s\n", save_path, seconds_since(save_start));
+	}
+#ifdef OSMOSIM_PROFILE
+	PrintProfile();
+#endif
+	
+	return 0;
+}
@@ -1,5 +1,13 @@
 #include "game.hpp"
+#include "profile.hpp"
+#include "render.hpp"
+#include "snapshot.hpp"
+#include "timestep.hpp"
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 #include <raylib.h>
 
 using namespace std;
@@ -8,8 +16,33 @@ using namespace std;
 #define WINDOW_WIDTH 640
 #define WINDOW_HEIGHT 480
 #define WINDOW_ZOOM 50
+#define WORLD_SIZE 20
+#define SIM_STEP (1. / 60)
+#define MAX_SUBSTEPS 256
+#define SIM_BUDGET 0.012 //wall seconds per frame
 
 int main(int argc, char** argv) {
+	//world size, grid depth and an optional snapshot to start from
+	float world_size = WORLD_SIZE;
+	int depth = GRID_DEPTH;
+	const char* load_path = nullptr;
+	for (int i = 1; i < argc; i++) {
+		const bool has_val = i + 1 < argc;
+		if (!strcmp(argv[i], "-w") && has_val) world_size = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-d") && has_val) depth = atoi(argv[++i]);
+		else if (argv[i][0] != '-' && load_path == nullptr) load_path = argv[i];
+		else world_size = 0;
+	}
+	if (world_size <= 0 || depth < 0 || depth > GRID_MAX_DEPTH) {
+		fprintf(stderr, "usage: %s [-w <half world width>] [-d <grid depth 0-%d>] [snapshot]\n", argv[0], GRID_MAX_DEPTH);
+		return 1;
+	}
+	Snapshot snap;
+	if (load_path != nullptr && !snap.Open(load_path)) {
+		fprintf(stderr, "%s: not a valid snapshot\n", load_path);
+		return 1;
+	}
+	
 	SetConfigFlags(FLAG_WINDOW_RESIZABLE);
 	InitWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Osmosim");
 	// ToggleBorderlessWindowed();
@@ -19,8 +52,14 @@ int main(int argc, char** argv) {
 	InitTextures();
 	Font font = LoadFontEx("Fonts/DroidSansMono.ttf", 32, nullptr, 0);
 	
-	Game g(AABB({-20,-20}, {20,20}));
+	Game g(snap.IsOpen() ? snap.Bounds() : AABB({-world_size,-world_size}, {world_size,world_size}), 1, depth);
+	if (snap.IsOpen()) {
+		g.Load(snap);
+		snap.Close();
+	}
 	float sim_speed = 1;
+	FixedTimestep clock(SIM_STEP, MAX_SUBSTEPS, SIM_BUDGET);
+	int substeps = 0;
 	bool paused = false;
 	Viewport cam = {0,0, WINDOW_ZOOM, WINDOW_WIDTH,WINDOW_HEIGHT};
 	debug_log log;
@@ -64,21 +103,53 @@ int main(int argc, char** argv) {
 				break;
 			case 'f':
 				if (Rel(KEY_ONE)) param.allow_splitting = !param.allow_splitting;
+				if (Rel(KEY_TWO)) param.nbody_gravity = !param.nbody_gravity;
+				if (Rel(KEY_THREE)) param.threads = param.threads > 1 ? 1 : std::max(1u, std::thread::hardware_concurrency());
+				if (Rel(KEY_FOUR)) param.auto_depth = !param.auto_depth;
+				if (Rel(KEY_FIVE)) g.SetGridDepth(g.GetGridDepth() - 1);
+				if (Rel(KEY_SIX)) g.SetGridDepth(g.GetGridDepth() + 1);
+				if (Rel(KEY_SEVEN)) param.swept = !param.swept;
+				if (Rel(KEY_EIGHT)) param.block_levels = (param.block_levels + 1) % 5;
+				if (Rel(KEY_NINE)) param.kepler = !param.kepler;
 				break;
 		}
 		
 		//Simulation
-		if (!paused)
-			g.Update(param, dt * sim_speed);
+		substeps = 0;
+		const uint64_t updates = g.GetMoteUpdates();
+		if (!paused) {
+			substeps = clock.Advance(dt * sim_speed);
+			const double start = GetTime();
+			g.Step(param, clock.step, substeps, true);
+			clock.Report(substeps, GetTime() - start);
+		}
 		
 		//Rendering
 		BeginDrawing();
 		ClearBackground({0, 20, 50, 255});
 		char txt[2048];
-		g.Render(cam, param, 0);
+		RenderGame(g, cam, param, 0, paused ? 1 : clock.Alpha());
 		if (param_mode) {
 			log.clear();
 			log.append("[%c]\n%d FPS\n\n", param_mode, GetFPS());
+			log.append("speed x%g, %d steps/frame\n", sim_speed, substeps);
+			log.append("grid depth %d%s\n", g.GetGridDepth(), param.auto_depth ? " (auto)" : "");
+			if (param.block_levels > 0)
+				log.append("block levels %d, %.0f updates/step\n", param.block_levels,
+					substeps > 0 ? (g.GetMoteUpdates() - updates) / static_cast<double>(substeps) : 0.);
+			if (param.kepler)
+				log.append("%zu motes coasting\n", g.CoastingCount());
+			const memory_stats mem = g.GetMemoryStats();
+			log.append("memory %.1f MB, %.0f%% of motes and %.0f%% of grid unused\n", mem.Bytes() / 1e6,
+				mem.motes.Fragmentation() * 100, mem.broadphase.Fragmentation() * 100);
+#ifdef OSMOSIM_PROFILE
+			//last step only
+			log.append("\n");
+			const profile_stats* prof = profile_last();
+			for (int p = 0; p < PROF_PHASES; p++)
+				log.append("%s %.3f ms, %llu allocs\n", profile_name(static_cast<profile_phase>(p)),
+					prof[p].seconds * 1e3, static_cast<unsigned long long>(prof[p].allocs));
+#endif
 			DrawTextEx(font, log.get(), {10,10}, 32, 0, WHITE);
 		}
 		EndDrawing();
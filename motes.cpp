@@ -0,0 +1,121 @@
+#include "motes.hpp"
+#include <algorithm>
+
+
+void MoteStore::Reserve(size_t n) {
+	px.reserve(n), py.reserve(n);
+	ppx.reserve(n), ppy.reserve(n);
+	vx.reserve(n), vy.reserve(n);
+	radius.reserve(n);
+	time_offset.reserve(n);
+	split_cooldown.reserve(n);
+	type.reserve(n);
+	id.reserve(n);
+	handle.reserve(n);
+	index.reserve(n);
+}
+
+void MoteStore::Clear(void) {
+	px.clear(), py.clear();
+	ppx.clear(), ppy.clear();
+	vx.clear(), vy.clear();
+	radius.clear();
+	time_offset.clear();
+	split_cooldown.clear();
+	type.clear();
+	id.clear();
+	handle.clear();
+	index.clear();
+}
+
+void MoteStore::Reindex(void) {
+	ppx = px, ppy = py;
+	handle.resize(size());
+	index.Refill(size(), [](size_t i) { return static_cast<uint32_t>(i); }, handle.data());
+	peak = std::max(peak, size());
+}
+
+uint32_t MoteStore::Add(uint64_t mote_id, const Mote& m) {
+	const uint32_t i = size();
+	px.push_back(m.pos.x), py.push_back(m.pos.y);
+	ppx.push_back(m.pos.x), ppy.push_back(m.pos.y);
+	vx.push_back(m.vel.x), vy.push_back(m.vel.y);
+	radius.push_back(m.radius);
+	time_offset.push_back(m.time_offset);
+	split_cooldown.push_back(m.split_cooldown);
+	type.push_back(m.type);
+	id.push_back(mote_id);
+	handle.push_back(index.Insert(i));
+	peak = std::max(peak, size());
+	return i;
+}
+
+void MoteStore::Remove(uint32_t i) {
+	const uint32_t last = size() - 1;
+	index.Remove(handle[i]);
+	if (i != last) {
+		px[i] = px[last], py[i] = py[last];
+		ppx[i] = ppx[last], ppy[i] = ppy[last];
+		vx[i] = vx[last], vy[i] = vy[last];
+		radius[i] = radius[last];
+		time_offset[i] = time_offset[last];
+		split_cooldown[i] = split_cooldown[last];
+		type[i] = type[last];
+		id[i] = id[last];
+		handle[i] = handle[last];
+		*index.Find(handle[i]) = i;
+	}
+	px.pop_back(), py.pop_back();
+	ppx.pop_back(), ppy.pop_back();
+	vx.pop_back(), vy.pop_back();
+	radius.pop_back();
+	time_offset.pop_back();
+	split_cooldown.pop_back();
+	type.pop_back();
+	id.pop_back();
+	handle.pop_back();
+}
+
+void MoteStore::Swap(uint32_t i, uint32_t j) {
+	if (i == j) return;
+	std::swap(px[i], px[j]), std::swap(py[i], py[j]);
+	std::swap(ppx[i], ppx[j]), std::swap(ppy[i], ppy[j]);
+	std::swap(vx[i], vx[j]), std::swap(vy[i], vy[j]);
+	std::swap(radius[i], radius[j]);
+	std::swap(time_offset[i], time_offset[j]);
+	std::swap(split_cooldown[i], split_cooldown[j]);
+	std::swap(type[i], type[j]);
+	std::swap(id[i], id[j]);
+	std::swap(handle[i], handle[j]);
+	*index.Find(handle[i]) = i;
+	*index.Find(handle[j]) = j;
+}
+
+pool_stats MoteStore::GetStats(void) const {
+	const size_t bytes = VectorBytes(px) + VectorBytes(py) + VectorBytes(ppx) + VectorBytes(ppy) +
+		VectorBytes(vx) + VectorBytes(vy) + VectorBytes(radius) + VectorBytes(time_offset) +
+		VectorBytes(split_cooldown) + VectorBytes(type) + VectorBytes(id) + VectorBytes(handle) + index.bytes();
+	const size_t row = 9 * sizeof(float) + sizeof(MoteType) + sizeof(uint64_t) + sizeof(Handle);
+	return {size(), peak, bytes, size() * (row + SlotMap<uint32_t>::SLOT_BYTES)};
+}
+
+Mote MoteStore::Get(uint32_t i) const {
+	Mote m;
+	m.pos = Pos(i);
+	m.vel = Vel(i);
+	m.radius = radius[i];
+	m.type = type[i];
+	m.time_offset = time_offset[i];
+	m.split_cooldown = split_cooldown[i];
+	return m;
+}
+
+void MoteStore::Set(uint32_t i, const Mote& m) {
+	SetPos(i, m.pos);
+	ppx[i] = m.pos.x, ppy[i] = m.pos.y;
+	SetVel(i, m.vel);
+	radius[i] = m.radius;
+	time_offset[i] = m.time_offset;
+	split_cooldown[i] = m.split_cooldown;
+	type[i] = m.type;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "common.hpp"
+#include "collision.hpp"
+#include "slotmap.hpp"
+
+
+constexpr float MIN_RADIUS = 0.0005;
+constexpr float SPLIT_COOLDOWN = 0.1;
+constexpr float GRAVITY_CONSTANT = 1;
+constexpr float SPLIT_VELOCITY = 0.5;
+constexpr float GRAVITY_SOFTENING = 0.001; //only used for mote to mote gravity
+
+enum MoteType : uint8_t {
+	MOTE_AMBIENT, MOTE_ATTRACTOR
+};
+
+//mote property getter functions
+inline bool IsAttractor(MoteType t) { return t == MOTE_ATTRACTOR; }
+inline float GetCriticalRadius(MoteType t) { return t == MOTE_ATTRACTOR ? 1 : 0.075; }
+
+//a single mote by value, used to add motes to and read them from a MoteStore
+struct Mote {
+	vec2 pos, vel;
+	float radius;
+	float time_offset;
+	float split_cooldown;
+	MoteType type;
+	
+	Mote(void) : radius(0), time_offset(0), split_cooldown(0), type(MOTE_AMBIENT) {}
+	Mote(vec2 pos, float r, MoteType type = MOTE_AMBIENT)
+	: pos(pos), vel(0), radius(r), time_offset(0), split_cooldown(SPLIT_COOLDOWN), type(type) {}
+	
+	AABB GetAABB() const { return Circle(pos, radius).GetAABB(); }
+	Circle GetCircle() const { return Circle(pos, radius); }
+	
+	bool IsAttractor(void) const { return ::IsAttractor(type); }
+	float GetCriticalRadius(void) const { return ::GetCriticalRadius(type); }
+};
+
+struct AttractorMote : public Mote {
+	AttractorMote(vec2 pos, float r) : Mote(pos, r, MOTE_ATTRACTOR) {}
+};
+
+
+//structure of arrays holding every mote
+//indices are dense: removing a mote moves the last one into its slot
+class MoteStore {
+public:
+	std::vector<float> px, py; //position
+	std::vector<float> ppx, ppy; //position before the last step, see Game::Step()
+	std::vector<float> vx, vy; //velocity
+	std::vector<float> radius;
+	std::vector<float> time_offset;
+	std::vector<float> split_cooldown;
+	std::vector<MoteType> type;
+	std::vector<uint64_t> id; //serial number, keys the random draws, snapshots and recordings
+	std::vector<Handle> handle;
+	
+private:
+	SlotMap<uint32_t> index; //handle -> store index
+	size_t peak = 0; //most motes stored at once
+	
+public:
+	size_t size(void) const { return id.size(); }
+	bool empty(void) const { return id.empty(); }
+	
+	void Reserve(size_t n);
+	void Clear(void);
+	void SavePositions(void) { ppx = px, ppy = py; }
+	//hands out new handles after the columns were filled directly, previous positions are reset
+	//handles from before stay stale, every slot's generation moves past the ones it had
+	void Reindex(void);
+	
+	//appends a mote and returns its index
+	uint32_t Add(uint64_t mote_id, const Mote& m);
+	//swap-removes the mote at index i, its handle becomes stale
+	void Remove(uint32_t i);
+	//exchanges the rows of two motes, their handles follow them
+	void Swap(uint32_t i, uint32_t j);
+	//a removed mote's row and handle slot are what the next Add() reuses, so the columns and the
+	//handle slots only grow up to the peak
+	pool_stats GetStats(void) const;
+	//returns the index of a mote or -1 if the handle is stale
+	int64_t Find(Handle h) const {
+		const uint32_t* i = index.Find(h);
+		return i != nullptr ? static_cast<int64_t>(*i) : -1;
+	}
+	
+	Mote Get(uint32_t i) const;
+	void Set(uint32_t i, const Mote& m);
+	
+	vec2 Pos(uint32_t i) const { return vec2(px[i], py[i]); }
+	vec2 Vel(uint32_t i) const { return vec2(vx[i], vy[i]); }
+	vec2 PrevPos(uint32_t i) const { return vec2(ppx[i], ppy[i]); }
+	//position between the previous and current step, alpha 0 -> 1
+	vec2 Lerp(uint32_t i, float alpha) const { return PrevPos(i) + (Pos(i) - PrevPos(i)) * alpha; }
+	void SetPos(uint32_t i, vec2 p) { px[i] = p.x, py[i] = p.y; }
+	void SetVel(uint32_t i, vec2 v) { vx[i] = v.x, vy[i] = v.y; }
+	
+	Circle GetCircle(uint32_t i) const { return Circle(Pos(i), radius[i]); }
+	AABB GetAABB(uint32_t i) const { return GetCircle(i).GetAABB(); }
+};
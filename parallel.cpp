@@ -0,0 +1,57 @@
+#include "parallel.hpp"
+
+
+ThreadPool::ThreadPool(int threads) : job(nullptr), context(nullptr), tasks(0), next_task(0), busy(0), batch(0), stop(false) {
+	for (int i = 1; i < threads; i++)
+		workers.emplace_back(&ThreadPool::Work, this);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	wake.notify_all();
+	for (std::thread& t : workers) t.join();
+}
+
+void ThreadPool::Drain(void) {
+	for (;;) {
+		const size_t t = next_task.fetch_add(1, std::memory_order_relaxed);
+		if (t >= tasks) return;
+		job(context, t);
+	}
+}
+
+void ThreadPool::Work(void) {
+	uint64_t seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stop || batch != seen; });
+			if (stop) return;
+			seen = batch;
+		}
+		Drain();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--busy == 0) done.notify_one();
+		}
+	}
+}
+
+void ThreadPool::RunBatch(size_t tasks, void (*fn)(const void*, size_t), const void* ctx) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = fn;
+		context = ctx;
+		this->tasks = tasks;
+		next_task.store(0, std::memory_order_relaxed);
+		busy = workers.size();
+		batch++;
+	}
+	wake.notify_all();
+	Drain();
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&] { return busy == 0; });
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//fixed set of worker threads that run batches of independent tasks
+class ThreadPool {
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	
+	//the batch being run, job(context, task) calls the function handed to Run()
+	void (*job)(const void*, size_t);
+	const void* context;
+	size_t tasks;
+	std::atomic<size_t> next_task;
+	int busy; //workers still inside the current batch
+	uint64_t batch; //incremented for every Run()
+	bool stop;
+	
+	void Work(void);
+	void Drain(void);
+	void RunBatch(size_t tasks, void (*fn)(const void*, size_t), const void* ctx);
+	
+public:
+	//threads includes the calling thread, so 1 means no workers
+	explicit ThreadPool(int threads);
+	~ThreadPool();
+	
+	int Size(void) const { return workers.size() + 1; }
+	
+	//calls fn(task) for every task in [0, tasks) and returns once all are done
+	//the calling thread takes part, tasks are handed out in order but finish in any order
+	//fn is called through a pointer, unlike a std::function nothing is allocated per batch
+	template <typename F>
+	void Run(size_t tasks, const F& fn) {
+		RunBatch(tasks, [](const void* f, size_t t) { (*static_cast<const F*>(f))(t); }, &fn);
+	}
+};
+
+//splits [0, n) into chunks of the given size and calls fn(begin, end, chunk) for each
+//runs serially when pool is null
+template <typename F>
+void ParallelFor(ThreadPool* pool, size_t n, size_t chunk, F&& fn) {
+	if (n == 0) return;
+	chunk = std::max<size_t>(chunk, 1);
+	const size_t chunks = (n + chunk - 1) / chunk;
+	auto run = [&](size_t c) { fn(c * chunk, std::min(n, (c+1) * chunk), c); };
+	if (pool == nullptr || chunks <= 1) {
+		for (size_t c = 0; c < chunks; c++) run(c);
+		return;
+	}
+	pool->Run(chunks, run);
+}
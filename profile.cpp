@@ -0,0 +1,128 @@
+#include "profile.hpp"
+
+#ifdef OSMOSIM_PROFILE
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+//counts every thread, so a phase also sees what the pool workers allocate while it runs
+static std::atomic<uint64_t> alloc_count(0);
+
+//every allocation of the program goes through here while profiling, the whole set is replaced so
+//every form of new and delete pairs up, all of it stays out of line or gcc sees malloc() and free()
+//inlined on either side and reports them as mismatched
+[[gnu::noinline]] void* operator new(size_t n, const std::nothrow_t&) noexcept {
+	alloc_count.fetch_add(1, std::memory_order_relaxed);
+	return malloc(n > 0 ? n : 1);
+}
+[[gnu::noinline]] void* operator new(size_t n) {
+	if (void* p = operator new(n, std::nothrow)) return p;
+	throw std::bad_alloc();
+}
+[[gnu::noinline]] void* operator new[](size_t n) { return operator new(n); }
+[[gnu::noinline]] void* operator new[](size_t n, const std::nothrow_t& t) noexcept { return operator new(n, t); }
+[[gnu::noinline]] void* operator new(size_t n, std::align_val_t a, const std::nothrow_t&) noexcept {
+	alloc_count.fetch_add(1, std::memory_order_relaxed);
+	const size_t align = static_cast<size_t>(a);
+	return aligned_alloc(align, (std::max<size_t>(n, 1) + align - 1) / align * align);
+}
+[[gnu::noinline]] void* operator new(size_t n, std::align_val_t a) {
+	if (void* p = operator new(n, a, std::nothrow)) return p;
+	throw std::bad_alloc();
+}
+[[gnu::noinline]] void* operator new[](size_t n, std::align_val_t a) { return operator new(n, a); }
+[[gnu::noinline]] void* operator new[](size_t n, std::align_val_t a, const std::nothrow_t& t) noexcept {
+	return operator new(n, a, t);
+}
+[[gnu::noinline]] void operator delete(void* p) noexcept { free(p); }
+[[gnu::noinline]] void operator delete[](void* p) noexcept { free(p); }
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept { free(p); }
+[[gnu::noinline]] void operator delete[](void* p, size_t) noexcept { free(p); }
+[[gnu::noinline]] void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+[[gnu::noinline]] void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::align_val_t) noexcept { free(p); }
+[[gnu::noinline]] void operator delete[](void* p, std::align_val_t) noexcept { free(p); }
+[[gnu::noinline]] void operator delete(void* p, size_t, std::align_val_t) noexcept { free(p); }
+[[gnu::noinline]] void operator delete[](void* p, size_t, std::align_val_t) noexcept { free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { free(p); }
+[[gnu::noinline]] void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { free(p); }
+
+
+static profile_stats current[PROF_PHASES];
+static profile_stats last[PROF_PHASES];
+static profile_stats total[PROF_PHASES];
+static uint64_t steps = 0;
+static FILE* csv = nullptr;
+static bool csv_failed = false;
+
+const char* profile_name(profile_phase p) {
+	static const char* names[PROF_PHASES] = {
+		"attract", "integrate", "surface", "split", "broadphase", "narrowphase", "reinsert", "coast", "commands", "area"
+	};
+	return names[p];
+}
+
+uint64_t profile_allocs(void) {
+	return alloc_count.load(std::memory_order_relaxed);
+}
+
+void profile_add(profile_phase p, double seconds, uint64_t allocs) {
+	current[p].seconds += seconds;
+	current[p].calls++;
+	current[p].allocs += allocs;
+}
+
+void profile_end_step(uint64_t step) {
+	if (csv != nullptr) {
+		int w = fprintf(csv, "%llu", static_cast<unsigned long long>(step));
+		for (int p = 0; p < PROF_PHASES && w >= 0; p++)
+			w = fprintf(csv, ",%.6f,%llu,%llu", current[p].seconds * 1e3,
+				static_cast<unsigned long long>(current[p].calls), static_cast<unsigned long long>(current[p].allocs));
+		if (w < 0 || fputc('\n', csv) == EOF) csv_failed = true;
+	}
+	for (int p = 0; p < PROF_PHASES; p++) {
+		last[p] = current[p];
+		total[p].seconds += current[p].seconds;
+		total[p].calls += current[p].calls;
+		total[p].allocs += current[p].allocs;
+		current[p] = {0, 0, 0};
+	}
+	steps++;
+}
+
+const profile_stats* profile_last(void) {
+	return last;
+}
+
+const profile_stats* profile_total(void) {
+	return total;
+}
+
+uint64_t profile_steps(void) {
+	return steps;
+}
+
+bool profile_open_csv(const char* path) {
+	profile_close_csv();
+	csv = fopen(path, "w");
+	if (csv == nullptr) return false;
+	csv_failed = false;
+	fprintf(csv, "step");
+	for (int p = 0; p < PROF_PHASES; p++) {
+		const char* n = profile_name(static_cast<profile_phase>(p));
+		fprintf(csv, ",%s_ms,%s_calls,%s_allocs", n, n, n);
+	}
+	fputc('\n', csv);
+	return true;
+}
+
+bool profile_close_csv(void) {
+	if (csv == nullptr) return true;
+	const bool ok = fclose(csv) == 0 && !csv_failed;
+	csv = nullptr;
+	return ok;
+}
+
+#endif
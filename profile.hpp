@@ -0,0 +1,93 @@
+#pragma once
+
+//Per phase step profiler, only compiled in with OSMOSIM_PROFILE defined (make PROFILE=1).
+//Without it every PROFILE_* macro expands to nothing.
+//Phases are timed on the thread that runs the step, allocations are counted by a replaced global
+//operator new on every thread, so a phase includes what the pool workers allocate during it. The
+//parallel step times whole passes, its collision detection counts as broad-phase and the resolution
+//as narrow-phase.
+
+#ifdef OSMOSIM_PROFILE
+#include <chrono>
+#include <cstdint>
+
+enum profile_phase {
+	PROF_ATTRACT,
+	PROF_INTEGRATE,
+	PROF_SURFACE,
+	PROF_SPLIT,
+	PROF_BROADPHASE, //candidate gathering
+	PROF_NARROWPHASE, //overlap tests and mote collisions
+	PROF_REINSERT, //moving motes in the broad-phase
+	PROF_COAST, //moving coasting motes and trying to let others coast
+	PROF_COMMANDS, //applying spawns and removals
+	PROF_AREA,
+	PROF_PHASES
+};
+
+struct profile_stats {
+	double seconds;
+	uint64_t calls;
+	uint64_t allocs;
+};
+
+const char* profile_name(profile_phase p);
+//allocations made by all threads so far
+uint64_t profile_allocs(void);
+void profile_add(profile_phase p, double seconds, uint64_t allocs);
+
+//closes a step, its stats become profile_last() and go to the CSV file if one is open
+void profile_end_step(uint64_t step);
+//PROF_PHASES entries each
+const profile_stats* profile_last(void);
+const profile_stats* profile_total(void);
+uint64_t profile_steps(void);
+
+//one row per step: step, then milliseconds, calls and allocations of every phase
+bool profile_open_csv(const char* path);
+//false if any write failed
+bool profile_close_csv(void);
+
+//times its own lifetime
+class profile_scope {
+	profile_phase phase;
+	std::chrono::steady_clock::time_point start;
+	uint64_t allocs;
+
+public:
+	explicit profile_scope(profile_phase p)
+	: phase(p), start(std::chrono::steady_clock::now()), allocs(profile_allocs()) {}
+	~profile_scope() {
+		const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		profile_add(phase, s, profile_allocs() - allocs);
+	}
+};
+
+//gives the time since the previous Lap() to a phase, one clock read per phase for hot loops
+class profile_laps {
+	std::chrono::steady_clock::time_point last;
+	uint64_t allocs;
+
+public:
+	profile_laps(void) : last(std::chrono::steady_clock::now()), allocs(profile_allocs()) {}
+	void Lap(profile_phase p) {
+		const auto now = std::chrono::steady_clock::now();
+		const uint64_t a = profile_allocs();
+		profile_add(p, std::chrono::duration<double>(now - last).count(), a - allocs);
+		last = now, allocs = a;
+	}
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(phase) profile_scope PROFILE_CONCAT(profile_scope_, __LINE__)(phase)
+#define PROFILE_LAPS(name) profile_laps name
+#define PROFILE_LAP(name, phase) name.Lap(phase)
+#define PROFILE_END_STEP(step) profile_end_step(step)
+
+#else
+#define PROFILE_SCOPE(phase)
+#define PROFILE_LAPS(name)
+#define PROFILE_LAP(name, phase)
+#define PROFILE_END_STEP(step)
+#endif
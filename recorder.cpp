@@ -0,0 +1,427 @@
+#include "recorder.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+//little-endian encoding helpers
+
+static void PutU8(std::vector<uint8_t>& out, uint8_t v) {
+	out.push_back(v);
+}
+
+static void PutU32(std::vector<uint8_t>& out, uint32_t v) {
+	for (int b = 0; b < 4; b++) out.push_back(v >> (8 * b));
+}
+
+static void PutU64(std::vector<uint8_t>& out, uint64_t v) {
+	for (int b = 0; b < 8; b++) out.push_back(v >> (8 * b));
+}
+
+static void PutF32(std::vector<uint8_t>& out, float v) {
+	uint32_t bits;
+	memcpy(&bits, &v, 4);
+	PutU32(out, bits);
+}
+
+static void PutVarint(std::vector<uint8_t>& out, uint64_t v) {
+	while (v >= 0x80) {
+		out.push_back(v | 0x80);
+		v >>= 7;
+	}
+	out.push_back(v);
+}
+
+//small magnitudes of either sign become small numbers
+static void PutZigzag(std::vector<uint8_t>& out, int64_t v) {
+	PutVarint(out, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+}
+
+//reads from a byte range, ok turns false on reading past its end
+struct byte_reader {
+	const uint8_t* p;
+	const uint8_t* end;
+	bool ok;
+	
+	byte_reader(const uint8_t* p, size_t size) : p(p), end(p + size), ok(true) {}
+	
+	uint64_t Fixed(int bytes) {
+		if (end - p < bytes) {
+			ok = false;
+			return 0;
+		}
+		uint64_t v = 0;
+		for (int b = 0; b < bytes; b++) v |= static_cast<uint64_t>(*p++) << (8 * b);
+		return v;
+	}
+	float F32(void) {
+		const uint32_t bits = Fixed(4);
+		float v;
+		memcpy(&v, &bits, 4);
+		return v;
+	}
+	uint64_t Varint(void) {
+		uint64_t v = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (p == end) break;
+			const uint8_t b = *p++;
+			v |= static_cast<uint64_t>(b & 0x7F) << shift;
+			if ((b & 0x80) == 0) return v;
+		}
+		ok = false;
+		return 0;
+	}
+	int64_t Zigzag(void) {
+		const uint64_t v = Varint();
+		return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+	}
+};
+
+static constexpr size_t HEADER_BYTES = 8 + 4 + 4 + 3*4 + 8;
+static constexpr size_t RECORD_HEADER_BYTES = 1 + 8 + 8;
+
+//one mote with absolute values, shared by keyframes and spawn events
+static void PutMote(std::vector<uint8_t>& out, uint64_t id_delta, MoteType t, const int32_t q[5]) {
+	PutVarint(out, id_delta);
+	PutU8(out, t);
+	for (int f = 0; f < 5; f++) PutZigzag(out, q[f]);
+}
+
+static bool GetMote(byte_reader& in, uint64_t& id, MoteType& t, int32_t q[5]) {
+	id += in.Varint();
+	t = static_cast<MoteType>(in.Fixed(1));
+	for (int f = 0; f < 5; f++) q[f] = in.Zigzag();
+	return in.ok;
+}
+
+
+void trajectory_state::clear(void) {
+	id.clear();
+	px.clear(), py.clear();
+	vx.clear(), vy.clear();
+	radius.clear();
+	type.clear();
+}
+
+void trajectory_state::push_back(uint64_t mote_id, MoteType t, const int32_t q[5]) {
+	id.push_back(mote_id);
+	px.push_back(q[0]), py.push_back(q[1]);
+	vx.push_back(q[2]), vy.push_back(q[3]);
+	radius.push_back(q[4]);
+	type.push_back(t);
+}
+
+
+// Recorder
+
+bool Recorder::Open(const char* path, const trajectory_header& h) {
+	Close();
+	file = fopen(path, "wb");
+	if (file == nullptr) return false;
+	header = h;
+	if (header.keyframe_interval == 0) header.keyframe_interval = 1;
+	state.clear();
+	handle.clear();
+	start_step = 0, last_id = 0;
+	started = false, stop = false, failed = false;
+	
+	std::vector<uint8_t> out;
+	out.insert(out.end(), TRAJECTORY_MAGIC, TRAJECTORY_MAGIC + 8);
+	PutU32(out, TRAJECTORY_VERSION);
+	PutU32(out, header.keyframe_interval);
+	PutF32(out, header.pos_quantum);
+	PutF32(out, header.vel_quantum);
+	PutF32(out, header.radius_quantum);
+	PutU64(out, header.seed);
+	Push(std::move(out));
+	
+	writer = std::thread(&Recorder::Write, this);
+	return true;
+}
+
+bool Recorder::Close(void) {
+	if (file == nullptr) return !failed;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	wake.notify_one();
+	writer.join();
+	if (fclose(file) != 0) failed = true;
+	file = nullptr;
+	spare.clear();
+	return !failed;
+}
+
+void Recorder::Write(void) {
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		wake.wait(lock, [&] { return stop || !queue.empty(); });
+		if (queue.empty()) return; //stopped and drained
+		std::vector<uint8_t> record = std::move(queue.front());
+		queue.pop_front();
+		
+		lock.unlock();
+		const bool ok = fwrite(record.data(), 1, record.size(), file) == record.size();
+		lock.lock();
+		if (!ok) failed = true;
+		record.clear();
+		spare.push_back(std::move(record));
+	}
+}
+
+void Recorder::Push(std::vector<uint8_t>&& record) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(std::move(record));
+	}
+	wake.notify_one();
+}
+
+std::vector<uint8_t> Recorder::TakeBuffer(void) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (spare.empty()) return {};
+	std::vector<uint8_t> b = std::move(spare.back());
+	spare.pop_back();
+	return b;
+}
+
+size_t Recorder::Pending(void) {
+	std::lock_guard<std::mutex> lock(mutex);
+	return queue.size();
+}
+
+void Recorder::Quantize(const MoteStore& motes, uint32_t i, int32_t q[5]) const {
+	auto quantize = [](float v, float quantum) {
+		const float s = std::round(v / quantum);
+		return static_cast<int32_t>(std::clamp(s, -2147483520.f, 2147483520.f));
+	};
+	q[0] = quantize(motes.px[i], header.pos_quantum);
+	q[1] = quantize(motes.py[i], header.pos_quantum);
+	q[2] = quantize(motes.vx[i], header.vel_quantum);
+	q[3] = quantize(motes.vy[i], header.vel_quantum);
+	q[4] = quantize(motes.radius[i], header.radius_quantum);
+}
+
+void Recorder::Capture(uint64_t step, const MoteStore& motes) {
+	if (file == nullptr) return;
+	if (!started) start_step = step, started = true;
+	const bool keyframe = (step - start_step) % header.keyframe_interval == 0;
+	
+	//motes still alive get their deltas, removed ones are dropped from the state
+	removed.clear(), deltas.clear();
+	size_t removed_count = 0, o = 0;
+	uint64_t prev = 0;
+	for (size_t k = 0; k < state.size(); k++) {
+		const uint64_t id = state.id[k];
+		const int64_t i = motes.Find(handle[k]);
+		if (i < 0) {
+			PutVarint(removed, id - prev);
+			prev = id;
+			removed_count++;
+			continue;
+		}
+		int32_t q[5];
+		Quantize(motes, i, q);
+		int32_t* cols[5] = {&state.px[k], &state.py[k], &state.vx[k], &state.vy[k], &state.radius[k]};
+		for (int f = 0; f < 5; f++)
+			PutZigzag(deltas, static_cast<int64_t>(q[f]) - *cols[f]);
+		state.id[o] = id, state.type[o] = state.type[k];
+		state.px[o] = q[0], state.py[o] = q[1];
+		state.vx[o] = q[2], state.vy[o] = q[3];
+		state.radius[o] = q[4];
+		handle[o] = handle[k];
+		o++;
+	}
+	state.id.resize(o), state.type.resize(o);
+	state.px.resize(o), state.py.resize(o);
+	state.vx.resize(o), state.vy.resize(o);
+	state.radius.resize(o);
+	handle.resize(o);
+	
+	//everything newer than the newest id seen so far was spawned
+	spawned.clear();
+	for (uint32_t i = 0; i < motes.size(); i++)
+		if (motes.id[i] > last_id) spawned.push_back({motes.id[i], i});
+	std::sort(spawned.begin(), spawned.end());
+	
+	std::vector<uint8_t> record = TakeBuffer();
+	PutU8(record, keyframe ? TRAJ_KEYFRAME : TRAJ_DELTA);
+	PutU64(record, step);
+	PutU64(record, 0); //payload size, patched below
+	const size_t body = record.size();
+	
+	if (!keyframe) {
+		PutVarint(record, removed_count);
+		record.insert(record.end(), removed.begin(), removed.end());
+		PutVarint(record, spawned.size());
+	}
+	prev = 0;
+	for (const auto& [id, i] : spawned) {
+		int32_t q[5];
+		Quantize(motes, i, q);
+		if (!keyframe) PutMote(record, id - prev, motes.type[i], q);
+		state.push_back(id, motes.type[i], q);
+		handle.push_back(motes.handle[i]);
+		prev = last_id = id;
+	}
+	if (keyframe) {
+		PutVarint(record, state.size());
+		prev = 0;
+		for (size_t k = 0; k < state.size(); k++) {
+			const int32_t q[5] = {state.px[k], state.py[k], state.vx[k], state.vy[k], state.radius[k]};
+			PutMote(record, state.id[k] - prev, state.type[k], q);
+			prev = state.id[k];
+		}
+	} else {
+		record.insert(record.end(), deltas.begin(), deltas.end());
+	}
+	
+	const uint64_t size = record.size() - body;
+	for (int b = 0; b < 8; b++) record[body - 8 + b] = size >> (8 * b);
+	Push(std::move(record));
+}
+
+
+// Replayer
+
+bool Replayer::Open(const char* path) {
+	Close();
+	file = fopen(path, "rb");
+	if (file == nullptr) return false;
+	
+	uint8_t raw[HEADER_BYTES];
+	if (fread(raw, 1, HEADER_BYTES, file) != HEADER_BYTES || memcmp(raw, TRAJECTORY_MAGIC, 8) != 0) {
+		Close();
+		return false;
+	}
+	byte_reader in(raw + 8, HEADER_BYTES - 8);
+	const uint32_t version = in.Fixed(4);
+	header.keyframe_interval = in.Fixed(4);
+	header.pos_quantum = in.F32();
+	header.vel_quantum = in.F32();
+	header.radius_quantum = in.F32();
+	header.seed = in.Fixed(8);
+	if (version != TRAJECTORY_VERSION) {
+		Close();
+		return false;
+	}
+	
+	if (fseek(file, 0, SEEK_END) != 0) {
+		Close();
+		return false;
+	}
+	file_size = ftell(file);
+	
+	//index the keyframes, only record headers are read
+	keyframes.clear();
+	long offset = HEADER_BYTES, next;
+	trajectory_record type;
+	uint64_t rec_step;
+	bool any = false;
+	while (ReadRecord(offset, type, rec_step, next)) {
+		if (type == TRAJ_KEYFRAME) keyframes.push_back({rec_step, offset});
+		if (!any) first_step = rec_step, any = true;
+		last_step = rec_step;
+		offset = next;
+	}
+	//a file cut short by a crash is still usable up to its last whole record
+	if (keyframes.empty()) {
+		Close();
+		return false;
+	}
+	return Seek(first_step);
+}
+
+void Replayer::Close(void) {
+	if (file != nullptr) fclose(file);
+	file = nullptr;
+	keyframes.clear();
+	state.clear();
+	first_step = last_step = step = 0;
+	next_record = file_size = 0;
+}
+
+bool Replayer::ReadRecord(long offset, trajectory_record& type, uint64_t& rec_step, long& next) {
+	uint8_t raw[RECORD_HEADER_BYTES];
+	if (fseek(file, offset, SEEK_SET) != 0) return false;
+	if (fread(raw, 1, RECORD_HEADER_BYTES, file) != RECORD_HEADER_BYTES) return false;
+	byte_reader in(raw, RECORD_HEADER_BYTES);
+	type = static_cast<trajectory_record>(in.Fixed(1));
+	rec_step = in.Fixed(8);
+	const uint64_t size = in.Fixed(8);
+	next = offset + RECORD_HEADER_BYTES + size;
+	return next <= file_size; //the payload has to be complete
+}
+
+bool Replayer::Apply(trajectory_record type) {
+	byte_reader in(payload.data(), payload.size());
+	int32_t q[5];
+	MoteType t;
+	if (type == TRAJ_KEYFRAME) {
+		state.clear();
+		const uint64_t n = in.Varint();
+		uint64_t id = 0;
+		for (uint64_t k = 0; k < n && in.ok; k++)
+			if (GetMote(in, id, t, q)) state.push_back(id, t, q);
+		return in.ok;
+	}
+	
+	//drop removed motes, both lists are sorted by id
+	const uint64_t removed = in.Varint();
+	scratch.clear();
+	uint64_t next_removed = removed > 0 ? in.Varint() : UINT64_MAX;
+	uint64_t seen = 0;
+	for (size_t k = 0; k < state.size(); k++) {
+		if (state.id[k] == next_removed) {
+			next_removed = ++seen < removed ? next_removed + in.Varint() : UINT64_MAX;
+			continue;
+		}
+		const int32_t old[5] = {state.px[k], state.py[k], state.vx[k], state.vy[k], state.radius[k]};
+		scratch.push_back(state.id[k], state.type[k], old);
+	}
+	
+	//spawns come after every mote alive before them
+	const uint64_t spawns = in.Varint();
+	const size_t alive = scratch.size();
+	uint64_t id = 0;
+	for (uint64_t s = 0; s < spawns && in.ok; s++)
+		if (GetMote(in, id, t, q)) scratch.push_back(id, t, q);
+	
+	int32_t* cols[5] = {scratch.px.data(), scratch.py.data(), scratch.vx.data(), scratch.vy.data(), scratch.radius.data()};
+	for (size_t k = 0; k < alive && in.ok; k++)
+		for (int f = 0; f < 5; f++)
+			cols[f][k] += in.Zigzag();
+	std::swap(state, scratch);
+	return in.ok;
+}
+
+bool Replayer::Seek(uint64_t to) {
+	if (file == nullptr || to < first_step || to > last_step) return false;
+	auto it = std::upper_bound(keyframes.begin(), keyframes.end(), to,
+		[](uint64_t s, const keyframe& k) { return s < k.step; });
+	if (it == keyframes.begin()) return false;
+	--it;
+	//keep going from the current step if that is closer than the keyframe
+	if (!(next_record > 0 && step <= to && step >= it->step)) {
+		next_record = it->offset;
+		step = it->step - 1;
+		if (!Next()) return false;
+	}
+	while (step < to)
+		if (!Next()) return false;
+	return true;
+}
+
+bool Replayer::Next(void) {
+	if (file == nullptr) return false;
+	trajectory_record type;
+	uint64_t rec_step;
+	long next;
+	if (!ReadRecord(next_record, type, rec_step, next)) return false;
+	payload.resize(next - next_record - RECORD_HEADER_BYTES);
+	if (fread(payload.data(), 1, payload.size(), file) != payload.size()) return false;
+	if (!Apply(type)) return false;
+	step = rec_step;
+	next_record = next;
+	return true;
+}
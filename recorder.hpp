@@ -0,0 +1,144 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "motes.hpp"
+
+//Streaming trajectory files.
+//A header followed by records, each one is (type: u8, step: u64, payload bytes: u64, payload).
+//Keyframes hold the full state, the steps in between only hold what changed since the last one:
+//  removed ids, spawned motes and per mote deltas of position, velocity and radius.
+//Values are quantized to fixed steps and deltas are zigzag varints, so a mote that barely moved
+//costs about a byte per value. Deltas are taken against the quantized state, so the error stays
+//within half a quantum however long the run is.
+//All numbers are little-endian.
+
+constexpr char TRAJECTORY_MAGIC[8] = {'O','S','M','O','T','R','A','J'};
+constexpr uint32_t TRAJECTORY_VERSION = 1;
+
+struct trajectory_header {
+	uint32_t keyframe_interval; //steps between keyframes
+	float pos_quantum, vel_quantum, radius_quantum;
+	uint64_t seed; //of the recorded game
+	
+	trajectory_header(void)
+	: keyframe_interval(600), pos_quantum(1. / 65536), vel_quantum(1. / 65536), radius_quantum(1. / (1 << 24)), seed(0) {}
+};
+
+enum trajectory_record : uint8_t {
+	TRAJ_KEYFRAME,
+	TRAJ_DELTA,
+};
+
+//quantized state of every mote, sorted by id
+struct trajectory_state {
+	std::vector<uint64_t> id;
+	std::vector<int32_t> px, py, vx, vy, radius;
+	std::vector<MoteType> type;
+	
+	size_t size(void) const { return id.size(); }
+	void clear(void);
+	void push_back(uint64_t mote_id, MoteType t, const int32_t q[5]);
+};
+
+//records a game step by step, see BasicGame::SetRecorder()
+//encoding runs on the caller's thread, writing to disk on a background one, so Capture() never
+//waits for I/O. Encoded steps queue up in memory if the disk can't keep up.
+class Recorder {
+	trajectory_header header;
+	trajectory_state state; //what a replayer holds after the last record
+	std::vector<Handle> handle; //of every mote in state
+	uint64_t start_step;
+	uint64_t last_id; //highest id seen so far, ids are handed out in order so newer ones are spawns
+	bool started;
+	
+	//writer thread
+	FILE* file;
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::vector<uint8_t>> queue; //encoded records waiting to be written
+	std::vector<std::vector<uint8_t>> spare; //written buffers, reused by Capture()
+	bool stop;
+	bool failed;
+	
+	//scratch
+	std::vector<uint8_t> removed, deltas;
+	std::vector<std::pair<uint64_t, uint32_t>> spawned; //id, store index
+	
+	void Write(void);
+	void Push(std::vector<uint8_t>&& record);
+	std::vector<uint8_t> TakeBuffer(void);
+	void Quantize(const MoteStore& motes, uint32_t i, int32_t q[5]) const;
+
+public:
+	Recorder(void) : start_step(0), last_id(0), started(false), file(nullptr), stop(false), failed(false) {}
+	Recorder(const Recorder&) = delete;
+	Recorder& operator=(const Recorder&) = delete;
+	~Recorder() { Close(); }
+	
+	//creates the file and starts the writer thread, false if the file can't be created
+	bool Open(const char* path, const trajectory_header& h);
+	//writes everything still queued and closes the file, false if any write failed
+	bool Close(void);
+	bool IsOpen(void) const { return file != nullptr; }
+	
+	//records the state after a step, the first call writes a keyframe
+	void Capture(uint64_t step, const MoteStore& motes);
+	//amount of encoded records not written yet
+	size_t Pending(void);
+};
+
+//reads a trajectory file, seeks through its keyframes and plays it forward
+class Replayer {
+	struct keyframe {
+		uint64_t step;
+		long offset;
+	};
+	
+	trajectory_header header;
+	FILE* file;
+	long file_size;
+	std::vector<keyframe> keyframes;
+	uint64_t first_step, last_step;
+	trajectory_state state;
+	uint64_t step;
+	long next_record; //file offset of the record after the current step
+	std::vector<uint8_t> payload;
+	trajectory_state scratch;
+	
+	bool ReadRecord(long offset, trajectory_record& type, uint64_t& rec_step, long& next);
+	bool Apply(trajectory_record type);
+
+public:
+	Replayer(void) : file(nullptr), file_size(0), first_step(0), last_step(0), step(0), next_record(0) {}
+	Replayer(const Replayer&) = delete;
+	Replayer& operator=(const Replayer&) = delete;
+	~Replayer() { Close(); }
+	
+	//reads the header and indexes the keyframes, false if it isn't a trajectory file
+	bool Open(const char* path);
+	void Close(void);
+	
+	const trajectory_header& Header(void) const { return header; }
+	uint64_t FirstStep(void) const { return first_step; }
+	uint64_t LastStep(void) const { return last_step; }
+	uint64_t Step(void) const { return step; }
+	
+	//jumps to a recorded step through the nearest keyframe before it
+	bool Seek(uint64_t to);
+	//advances by one recorded step, false at the end of the file
+	bool Next(void);
+	
+	//state at Step(), values are dequantized on access
+	size_t size(void) const { return state.size(); }
+	uint64_t Id(size_t i) const { return state.id[i]; }
+	MoteType Type(size_t i) const { return state.type[i]; }
+	vec2 Pos(size_t i) const { return vec2(state.px[i], state.py[i]) * header.pos_quantum; }
+	vec2 Vel(size_t i) const { return vec2(state.vx[i], state.vy[i]) * header.vel_quantum; }
+	float Radius(size_t i) const { return state.radius[i] * header.radius_quantum; }
+};
@@ -0,0 +1,88 @@
+#include "render.hpp"
+#include "render_list.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+
+Texture2D tex[TEX_AMOUNT];
+float tex_scalars[TEX_AMOUNT];
+
+#define LOAD_TEX(file, en, scale) \
+	tex[en] = LoadTexture(file);\
+	SetTextureFilter(tex[en], TEXTURE_FILTER_BILINEAR);\
+	tex_scalars[en] = scale
+
+bool InitTextures(void) {
+	LOAD_TEX("Textures/spore.png", TEXTURE_AMBIENT, 1.37);
+	LOAD_TEX("Textures/spore3.png", TEXTURE_ATTRACTOR, 1.31);
+	return true;
+}
+
+
+void RenderAABB(const Viewport& view, AABB bb) {
+	auto [Ax, Ay] = view.ToScreen(bb.A.x, bb.A.y);
+	auto [Bx, By] = view.ToScreen(bb.B.x, bb.B.y);
+	DrawRectangleLines(Ax, Ay, Bx - Ax, By - Ay, WHITE);
+}
+
+void RenderAABBFilled(const Viewport& view, AABB bb, Color clr) {
+	auto [Ax, Ay] = view.ToScreen(bb.A.x, bb.A.y);
+	auto [Bx, By] = view.ToScreen(bb.B.x, bb.B.y);
+	DrawRectangleV({Ax, Ay}, {Bx - Ax, By - Ay}, clr);
+}
+
+static void RenderGridRecursive(const GridBroadPhase& grid, const Viewport& view, int x, int y, int d) {
+	if (!grid.isFilled(x, y, d)) return;
+	float inten = 1. - powf(1.3, -d);
+	Color clr = {static_cast<uint8_t>(inten * 255), 0, 0, 255};
+	RenderAABBFilled(view, grid.GetAABB(x, y, d), clr);
+	const uint32_t children = grid.FilledChildren(x, y, d);
+	for (int c = 0; c < 4; c++)
+		if (children >> c & 1)
+			RenderGridRecursive(grid, view, 2*x + (c & 1), 2*y + (c >> 1), d+1);
+}
+
+static void RenderCircleTex(const float x, const float y, const float r, const float rot, const texture_id id) {
+	const Texture2D tx = tex[id];
+	const float scale = tex_scalars[id];
+	const Rectangle src = {0, 0, (float)tx.width, (float)tx.height};
+	const Rectangle dst = {x, y, r*2*scale, r*2*scale};
+	const Vector2 origin = {r*scale, r*scale};
+	
+	DrawTexturePro(tx, src, dst, origin, rot, WHITE);
+}
+
+void RenderMote(const Mote& m, const Viewport& view, sim_params& param, const float time) {
+	//screen coordinates
+	const auto [x, y] = view.ToScreen(m.pos.x, m.pos.y);
+	const float r = m.radius * view.zoom;
+	
+	RenderCircleTex(x, y, r, 0, m.IsAttractor() ? TEXTURE_ATTRACTOR : TEXTURE_AMBIENT);
+	if (param.show_colliders) DrawCircleLines(static_cast<int>(round(x)), static_cast<int>(round(y)), r, WHITE);
+}
+
+void RenderGame(const Game& g, const Viewport& view, sim_params& param, const float time, const float alpha) {
+	static render_list list; //reused between frames
+	BuildRenderList(g, view, alpha, render_options(), list);
+	
+	//render grid
+	const GridBroadPhase& grid = g.GetBroadPhase();
+	if (param.show_grid) RenderGridRecursive(grid, view, 0, 0, 0);
+	
+	const MoteStore& motes = g.GetMotes();
+	for (const render_item& it : list.items) {
+		if (it.kind == RENDER_SPLAT) {
+			const uint8_t a = static_cast<uint8_t>(it.coverage * 255);
+			DrawRectangleV({it.x - it.r, it.y - it.r}, {it.r * 2, it.r * 2}, {200, 220, 255, a});
+			continue;
+		}
+		if (param.show_grid_colliders) {
+			const GridLocation loc = grid.GetLocation(motes.handle[it.mote]);
+			if (!loc.IsInvalid()) RenderAABB(view, loc.GetAABB(g.bounds)); //not for motes in the overflow
+		}
+		RenderCircleTex(it.x, it.y, it.r, 0, IsAttractor(it.type) ? TEXTURE_ATTRACTOR : TEXTURE_AMBIENT);
+		if (param.show_colliders) DrawCircleLines(static_cast<int>(round(it.x)), static_cast<int>(round(it.y)), it.r, WHITE);
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <raylib.h>
+#include "game.hpp"
+
+
+//game textures
+const int TEX_AMOUNT = 256;
+extern Texture2D tex[TEX_AMOUNT];
+extern float tex_scalars[TEX_AMOUNT];
+enum texture_id {
+	TEXTURE_AMBIENT, TEXTURE_ATTRACTOR, TEXTURE_AI, TEXTURE_PLAYER
+};
+
+bool InitTextures(void);
+
+void RenderAABB(const Viewport& view, AABB bb);
+void RenderAABBFilled(const Viewport& view, AABB bb, Color clr);
+
+void RenderMote(const Mote& m, const Viewport& view, sim_params& param, const float time);
+//alpha interpolates between the previous and the current step, see Game::Step()
+void RenderGame(const Game& g, const Viewport& view, sim_params& param, const float time, const float alpha = 1);
@@ -0,0 +1,145 @@
+#include "render_list.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+void render_list::clear(void) {
+	items.clear();
+	motes = splats = aggregated = 0;
+}
+
+//cost of finding a mote by id compared to streaming over one in the store
+static constexpr size_t LOOKUP_COST = 16;
+
+//state of one BuildRenderList() call
+struct render_builder {
+	const GridBroadPhase& grid;
+	const MoteStore& motes;
+	const Viewport& view;
+	const float alpha;
+	const render_options& opt;
+	render_list& out;
+	GridBroadPhase::CellBounds b; //visible cells per level
+	float mote_area; //average mote area in pixels, for subtree splats
+	int bins_w, bins_h;
+	
+	void AddSplat(float x, float y, float half, float coverage) {
+		out.items.push_back({x, y, half, std::min(coverage, 1.f), 0, MOTE_AMBIENT, RENDER_SPLAT});
+		out.splats++;
+	}
+	
+	void AddMote(uint32_t i) {
+		const vec2 p = motes.Lerp(i, alpha);
+		const auto [x, y] = view.ToScreen(p.x, p.y);
+		const float r = motes.radius[i] * view.zoom;
+		if (x + r < 0 || y + r < 0 || x - r > view.w || y - r > view.h) return;
+		if (r >= opt.min_pixels) {
+			out.items.push_back({x, y, r, 1, i, motes.type[i], RENDER_MOTE});
+			out.motes++;
+			return;
+		}
+		//small mote, goes into the screen bin under its center
+		const int bx = std::clamp(static_cast<int>(x / opt.splat_pixels), 0, bins_w - 1);
+		const int by = std::clamp(static_cast<int>(y / opt.splat_pixels), 0, bins_h - 1);
+		const uint32_t o = by * bins_w + bx;
+		render_list::bin& bin = out.bins[o];
+		if (bin.area == 0) out.touched.push_back(o);
+		const float a = M_PI * r * r;
+		bin.area += a;
+		bin.x += x * a;
+		bin.y += y * a;
+	}
+	
+	void Visit(int x, int y, int d) {
+		if (!grid.isFilled(x, y, d)) return;
+		const AABB cell = grid.GetAABB(x, y, d);
+		const float side = (cell.B.x - cell.A.x) * view.zoom;
+		//everything below is about as small as the cell, one splat for all of it
+		if (side <= opt.splat_pixels) {
+			const size_t n = grid.CountSubtree(x, y, d);
+			const auto [sx, sy] = view.ToScreen((cell.A.x + cell.B.x) * 0.5, (cell.A.y + cell.B.y) * 0.5);
+			AddSplat(sx, sy, side * 0.5, n * mote_area / (side * side));
+			out.aggregated += n;
+			return;
+		}
+		grid.GetInCell(b, x, y, d, [&](Handle h) {
+			const int64_t i = motes.Find(h);
+			if (i >= 0) AddMote(i);
+		});
+		if (d >= grid.GetDepth()) return;
+		const auto [bsx, bsy, bex, bey] = b[d+1];
+		const int sx = std::max(bsx, 2*x);
+		const int sy = std::max(bsy, 2*y);
+		const int ex = std::min(bex, 2*x+1);
+		const int ey = std::min(bey, 2*y+1);
+		for (int i = sy; i <= ey; i++)
+			for (int j = sx; j <= ex; j++)
+				Visit(j, i, d+1);
+	}
+	
+	//ids stored in the visible cells, an upper bound for the visible motes
+	size_t CountVisible(int x, int y, int d) const {
+		if (!grid.isFilled(x, y, d)) return 0;
+		size_t n = grid.CountInCell(x, y, d);
+		if (d >= grid.GetDepth()) return n;
+		const auto [bsx, bsy, bex, bey] = b[d+1];
+		const int sx = std::max(bsx, 2*x);
+		const int sy = std::max(bsy, 2*y);
+		const int ex = std::min(bex, 2*x+1);
+		const int ey = std::min(bey, 2*y+1);
+		for (int i = sy; i <= ey; i++)
+			for (int j = sx; j <= ex; j++)
+				n += CountVisible(j, i, d+1);
+		return n;
+	}
+	
+	void FlushBins(void) {
+		const float half = opt.splat_pixels * 0.5;
+		const float bin_area = opt.splat_pixels * opt.splat_pixels;
+		std::sort(out.touched.begin(), out.touched.end());
+		for (uint32_t o : out.touched) {
+			render_list::bin& bin = out.bins[o];
+			AddSplat(bin.x / bin.area, bin.y / bin.area, half, bin.area / bin_area);
+			bin = {0, 0, 0};
+		}
+		out.touched.clear();
+	}
+};
+
+
+void BuildRenderList(const Game& g, const Viewport& view, float alpha, const render_options& opt, render_list& out) {
+	out.clear();
+	const size_t n = g.MoteCount();
+	const float mote_area = n > 0 ? M_PI * g.GetTotalArea() / n * view.zoom * view.zoom : 0;
+	render_builder bld = {
+		g.GetBroadPhase(), g.GetMotes(), view, alpha, opt, out,
+		g.GetBroadPhase().GetCellBounds(view.GetAABB()), mote_area,
+		std::max(1, static_cast<int>(ceilf(view.w / opt.splat_pixels))),
+		std::max(1, static_cast<int>(ceilf(view.h / opt.splat_pixels)))
+	};
+	out.bins.resize(bld.bins_w * bld.bins_h, {0, 0, 0});
+	
+	//when the deepest cells are at least a splat wide nothing gets aggregated by cell, so it is
+	//cheaper to stream the whole store than to look up every visible id, unless few are visible
+	const GridBroadPhase& grid = g.GetBroadPhase();
+	const float deepest = (grid.GetBounds().B.x - grid.GetBounds().A.x) * view.zoom / (1 << grid.GetDepth());
+	if (deepest > opt.splat_pixels && bld.CountVisible(0, 0, 0) * LOOKUP_COST > n) {
+		for (uint32_t i = 0; i < n; i++)
+			bld.AddMote(i);
+	} else {
+		bld.Visit(0, 0, 0);
+		grid.GetInOverflow(view.GetAABB(), [&](Handle h) {
+			const int64_t i = g.GetMotes().Find(h);
+			if (i >= 0) bld.AddMote(i);
+		});
+	}
+	bld.FlushBins();
+	
+	//splats go first so they end up under the motes, motes are drawn from small to big
+	auto first_mote = std::stable_partition(out.items.begin(), out.items.end(), [](const render_item& it) {
+		return it.kind == RENDER_SPLAT;
+	});
+	std::sort(first_mote, out.items.end(), [](const render_item& a, const render_item& b) {
+		return a.r < b.r || (a.r == b.r && a.mote < b.mote);
+	});
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "game.hpp"
+
+//Render lists, everything the draw stage needs in screen coordinates and draw order.
+//Built without raylib, so it can be benchmarked headless (osmosim-bench render).
+//Motes smaller than min_pixels are not drawn one by one but summed into density splats:
+//grid cells that are at most splat_pixels wide on screen become one splat for their whole
+//subtree (estimated from how many ids it holds), small motes stored in larger cells are
+//binned into screen squares of splat_pixels.
+
+enum render_kind : uint8_t {
+	RENDER_SPLAT, //square of side 2*r, coverage says how much of it motes cover
+	RENDER_MOTE,
+};
+
+struct render_item {
+	float x, y; //screen center
+	float r; //screen radius, half the side of a splat
+	float coverage; //0 -> 1, only used by splats
+	uint32_t mote; //store index, only used by motes
+	MoteType type;
+	render_kind kind;
+};
+
+struct render_options {
+	float min_pixels; //motes with a smaller screen radius go into splats
+	float splat_pixels; //side of a splat on screen
+	
+	render_options(void) : min_pixels(0.75), splat_pixels(4) {}
+};
+
+struct render_list {
+	std::vector<render_item> items; //splats first, then motes from small to big
+	size_t motes, splats; //amount of items of each kind
+	size_t aggregated; //ids summed into subtree splats without visiting them
+	
+	//screen bins of small motes, reused between builds
+	struct bin {
+		float area, x, y; //area in pixels, area weighted position sums
+	};
+	std::vector<bin> bins;
+	std::vector<uint32_t> touched;
+	
+	render_list(void) : motes(0), splats(0), aggregated(0) {}
+	void clear(void);
+};
+
+//fills out with the visible part of the game, alpha interpolates like MoteStore::Lerp()
+void BuildRenderList(const Game& g, const Viewport& view, float alpha, const render_options& opt, render_list& out);
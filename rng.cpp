@@ -0,0 +1,7 @@
+#include "rng.hpp"
+
+
+void rng_floats(uint64_t seed, const uint64_t* ids, size_t n, uint64_t step, uint32_t stream, float* out) {
+	for (size_t i = 0; i < n; i++)
+		out[i] = rng_unit(rng_philox(seed, ids[i], step, stream).v[0]);
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+//Stateless counter-based random numbers (Philox4x32-10).
+//A value only depends on (seed, id, step, stream), so motes can draw in any order and on any
+//thread and a run is reproduced exactly by its seed.
+
+//what a number is used for, so different decisions of the same mote and step are independent
+enum rng_stream : uint32_t {
+	RNG_SPLIT, //word 0: split chance, word 1: split angle
+	RNG_TIME_OFFSET,
+	RNG_SCATTER, //initial world generation
+};
+
+struct rng_block {
+	uint32_t v[4];
+};
+
+inline rng_block rng_philox(uint64_t seed, uint64_t id, uint64_t step, uint32_t stream) {
+	uint32_t c0 = id, c1 = id >> 32, c2 = step, c3 = (static_cast<uint32_t>(step >> 32) << 8) ^ stream;
+	uint32_t k0 = seed, k1 = seed >> 32;
+	for (int r = 0; r < 10; r++) {
+		const uint64_t p0 = static_cast<uint64_t>(0xD2511F53) * c0;
+		const uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57) * c2;
+		const uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+		const uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+		c1 = p1, c3 = p0;
+		c0 = n0, c2 = n2;
+		k0 += 0x9E3779B9, k1 += 0xBB67AE85;
+	}
+	return {{c0, c1, c2, c3}};
+}
+
+//maps 32 random bits to [0, 1)
+inline float rng_unit(uint32_t bits) {
+	return (bits >> 8) * (1.f / 16777216);
+}
+
+//one number in [a, b)
+inline float rng_float(uint64_t seed, uint64_t id, uint64_t step, uint32_t stream, float a = 0, float b = 1) {
+	return a + (b - a) * rng_unit(rng_philox(seed, id, step, stream).v[0]);
+}
+
+//batch version, out[i] = rng_float(seed, ids[i], step, stream)
+//lanes are independent so the loop can be vectorized
+void rng_floats(uint64_t seed, const uint64_t* ids, size_t n, uint64_t step, uint32_t stream, float* out);
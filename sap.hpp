@@ -0,0 +1,210 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+#include "collision.hpp"
+
+//sweep and prune along the x axis, same interface as Grid, keys are handles too
+//boxes are kept sorted by their min x, moving a box re-sorts it with insertion sort steps,
+//so when little moves between steps updates cost close to nothing
+//boxes wider than big_width are kept apart in a short list that every query scans
+template <typename key>
+class SweepAndPrune {
+	AABB bounds;
+	float big_width;
+	
+	static constexpr uint32_t BIG = 0x80000000; //registry flag, index is into the big list
+	static constexpr float HOLE = std::numeric_limits<float>::infinity(); //min_y of removed entries
+	static constexpr size_t MAX_PENDING = 1024;
+	
+	//[0, sorted) is sorted by min_x, [sorted, size) holds new entries in any order
+	//removed entries stay behind as holes that never overlap anything until Flush()
+	std::vector<float> min_x, max_x, min_y, max_y;
+	std::vector<key> keys;
+	size_t sorted;
+	size_t holes;
+	
+	std::vector<AABB> big;
+	std::vector<key> big_keys;
+	
+	HandleTable<uint32_t> registry; //key -> entry
+	//Flush() scratch, kept so flushes stop allocating once it is big enough
+	std::vector<uint32_t> order, merged;
+	std::vector<float> float_scratch;
+	std::vector<key> key_scratch;
+	
+	void Set(uint32_t p, const AABB& bb) {
+		min_x[p] = bb.A.x, max_x[p] = bb.B.x;
+		min_y[p] = bb.A.y, max_y[p] = bb.B.y;
+	}
+	
+	void Swap(uint32_t a, uint32_t b) {
+		std::swap(min_x[a], min_x[b]), std::swap(max_x[a], max_x[b]);
+		std::swap(min_y[a], min_y[b]), std::swap(max_y[a], max_y[b]);
+		std::swap(keys[a], keys[b]);
+		if (min_y[a] != HOLE) registry[keys[a]] = a;
+		if (min_y[b] != HOLE) registry[keys[b]] = b;
+	}
+	
+	//insertion sort step for an entry of the sorted range whose min_x changed
+	void Sift(uint32_t p) {
+		while (p > 0 && min_x[p-1] > min_x[p]) {
+			Swap(p-1, p);
+			p--;
+		}
+		while (p + 1 < sorted && min_x[p+1] < min_x[p]) {
+			Swap(p, p+1);
+			p++;
+		}
+	}
+	
+	//drops holes and merges the pending entries into the sorted range
+	void Flush(void) {
+		size_t o = 0, new_sorted = 0;
+		for (size_t p = 0; p < keys.size(); p++) {
+			if (p == sorted) new_sorted = o;
+			if (min_y[p] == HOLE) continue;
+			min_x[o] = min_x[p], max_x[o] = max_x[p];
+			min_y[o] = min_y[p], max_y[o] = max_y[p];
+			keys[o] = keys[p];
+			o++;
+		}
+		if (sorted == keys.size()) new_sorted = o;
+		min_x.resize(o), max_x.resize(o), min_y.resize(o), max_y.resize(o), keys.resize(o);
+		
+		//sort the pending tail on its own, then merge both runs through a permutation
+		order.resize(o), merged.resize(o);
+		std::iota(order.begin(), order.end(), 0);
+		auto by_x = [&](uint32_t a, uint32_t b) { return min_x[a] < min_x[b]; };
+		std::sort(order.begin() + new_sorted, order.end(), by_x);
+		std::merge(order.begin(), order.begin() + new_sorted, order.begin() + new_sorted, order.end(), merged.begin(), by_x);
+		auto permute = [&](auto& v, auto& copy) {
+			copy.assign(v.begin(), v.end());
+			for (size_t p = 0; p < o; p++) v[p] = copy[merged[p]];
+		};
+		permute(min_x, float_scratch), permute(max_x, float_scratch);
+		permute(min_y, float_scratch), permute(max_y, float_scratch);
+		permute(keys, key_scratch);
+		
+		for (size_t p = 0; p < o; p++) registry[keys[p]] = p;
+		sorted = o;
+		holes = 0;
+	}
+	
+	bool IsBig(const AABB& bb) const { return bb.B.x - bb.A.x > big_width; }
+	
+public:
+	SweepAndPrune(AABB bb, float big_width = 0)
+	: bounds(bb), big_width(big_width > 0 ? big_width : (bb.B.x - bb.A.x) / 256), sorted(0), holes(0)
+	{}
+	
+	const AABB& GetBounds(void) const { return bounds; }
+	
+	void Clear(void) {
+		min_x.clear(), max_x.clear(), min_y.clear(), max_y.clear();
+		keys.clear();
+		big.clear(), big_keys.clear();
+		registry.clear();
+		sorted = 0, holes = 0;
+	}
+	
+	size_t size(void) const { return registry.size(); }
+	
+	//removes id
+	void Remove(const key id) {
+		const uint32_t* it = registry.Find(id);
+		if (it == nullptr) return;
+		const uint32_t p = *it;
+		registry.Erase(id);
+		if (p & BIG) {
+			const uint32_t b = p & ~BIG;
+			big[b] = big.back(), big_keys[b] = big_keys.back();
+			big.pop_back(), big_keys.pop_back();
+			if (b < big.size()) registry[big_keys[b]] = b | BIG;
+			return;
+		}
+		min_y[p] = HOLE;
+		if (++holes * 4 > keys.size()) Flush();
+	}
+	
+	//if key exists, moves its bounding box
+	void Insert(const key id, const AABB& bb) {
+		const uint32_t* it = registry.Find(id);
+		if (it != nullptr) {
+			const uint32_t p = *it;
+			if (((p & BIG) != 0) == IsBig(bb)) {
+				if (p & BIG) {
+					big[p & ~BIG] = bb;
+				} else {
+					Set(p, bb);
+					if (p < sorted) Sift(p);
+				}
+				return;
+			}
+			Remove(id); //moves between the big list and the sorted one
+		}
+		if (IsBig(bb)) {
+			registry[id] = big.size() | BIG;
+			big.push_back(bb);
+			big_keys.push_back(id);
+			return;
+		}
+		const uint32_t p = keys.size();
+		min_x.push_back(0), max_x.push_back(0), min_y.push_back(0), max_y.push_back(0);
+		keys.push_back(id);
+		Set(p, bb);
+		registry[id] = p;
+		if (keys.size() - sorted > MAX_PENDING) Flush();
+	}
+	
+	//replaces the contents with n unique ids, id_at(i) and box_at(i) give the i-th one
+	//sorts once instead of merging every MAX_PENDING inserts
+	template <typename IdAt, typename BoxAt>
+	void Build(size_t n, IdAt&& id_at, BoxAt&& box_at) {
+		Clear();
+		min_x.reserve(n), max_x.reserve(n), min_y.reserve(n), max_y.reserve(n);
+		keys.reserve(n);
+		registry.reserve(n);
+		for (size_t i = 0; i < n; i++) {
+			const key id = id_at(i);
+			const AABB bb = box_at(i);
+			if (IsBig(bb)) {
+				registry[id] = big.size() | BIG;
+				big.push_back(bb);
+				big_keys.push_back(id);
+				continue;
+			}
+			const uint32_t p = keys.size();
+			min_x.push_back(bb.A.x), max_x.push_back(bb.B.x);
+			min_y.push_back(bb.A.y), max_y.push_back(bb.B.y);
+			keys.push_back(id);
+			registry[id] = p;
+		}
+		Flush();
+	}
+	
+	//calls visit(id) once for every id whose bounding box collides with given one
+	//the structure must not be modified from inside visit
+	template <typename Visitor>
+	void GetInside(const AABB& bb, Visitor&& visit) const {
+		auto overlaps = [&](size_t p) {
+			return max_x[p] >= bb.A.x && min_y[p] <= bb.B.y && max_y[p] >= bb.A.y;
+		};
+		//small boxes starting further left than big_width can't reach bb
+		size_t p = std::lower_bound(min_x.begin(), min_x.begin() + sorted, bb.A.x - big_width) - min_x.begin();
+		for (; p < sorted && min_x[p] <= bb.B.x; p++)
+			if (overlaps(p)) visit(keys[p]);
+		for (p = sorted; p < keys.size(); p++)
+			if (min_x[p] <= bb.B.x && overlaps(p)) visit(keys[p]);
+		for (size_t b = 0; b < big.size(); b++)
+			if (big[b].B.x >= bb.A.x && big[b].A.x <= bb.B.x && big[b].B.y >= bb.A.y && big[b].A.y <= bb.B.y)
+				visit(big_keys[b]);
+	}
+	
+	//appends ids whose bounding box collides with given one, each id is added once
+	void GetInside(const AABB& bb, std::vector<key>& found) const {
+		GetInside(bb, [&found](const key id) { found.push_back(id); });
+	}
+};
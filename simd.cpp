@@ -0,0 +1,252 @@
+#include "simd.hpp"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+//every version keeps 8 partial sums, lane l takes the elements i with i % 8 == l in order
+//and the lanes are added up in order at the end, so the sum does not depend on the width
+static constexpr int LANES = 8;
+
+
+// Scalar versions, also handle the tails of the vector ones
+
+static void PullRange(const float* px, const float* py, float* vx, float* vy, const float* radius,
+	size_t begin, size_t end, float ax, float ay, float am, float* lx, float* ly) {
+	for (size_t i = begin; i < end; i++) {
+		const float dx = ax - px[i], dy = ay - py[i];
+		const float dist2 = dx*dx + dy*dy;
+		const float k = 1.f / (sqrtf(dist2) * dist2); //normalized direction / dist2
+		const float dxk = dx * k, dyk = dy * k;
+		const float m = radius[i] * radius[i];
+		vx[i] += dxk * am;
+		vy[i] += dyk * am;
+		lx[i % LANES] += dxk * m;
+		ly[i % LANES] += dyk * m;
+	}
+}
+
+static void SumLanes(const float* lx, const float* ly, float& rx, float& ry) {
+	float sx = 0, sy = 0;
+	for (int l = 0; l < LANES; l++) {
+		sx += lx[l];
+		sy += ly[l];
+	}
+	rx += sx;
+	ry += sy;
+}
+
+static void PullScalar(const float* px, const float* py, float* vx, float* vy, const float* radius, size_t n,
+	float ax, float ay, float am, float& rx, float& ry) {
+	float lx[LANES] = {}, ly[LANES] = {};
+	PullRange(px, py, vx, vy, radius, 0, n, ax, ay, am, lx, ly);
+	SumLanes(lx, ly, rx, ry);
+}
+
+static void IntegrateScalar(float* px, float* py, const float* vx, const float* vy, size_t n, float dt) {
+	for (size_t i = 0; i < n; i++) {
+		px[i] += vx[i] * dt;
+		py[i] += vy[i] * dt;
+	}
+}
+
+static size_t FirstOverlapScalar(float x, float y, float r, const float* cx, const float* cy, const float* cr,
+	size_t from, size_t n) {
+	for (size_t k = from; k < n; k++) {
+		const float dx = x - cx[k], dy = y - cy[k];
+		const float s = r + cr[k];
+		if (dx*dx + dy*dy <= s * s) return k;
+	}
+	return n;
+}
+
+
+#ifdef SIMD_X86
+
+// SSE2, two registers per block of 8
+
+__attribute__((target("sse2")))
+static void PullSSE2(const float* px, const float* py, float* vx, float* vy, const float* radius, size_t n,
+	float ax, float ay, float am, float& rx, float& ry) {
+	const __m128 vax = _mm_set1_ps(ax), vay = _mm_set1_ps(ay), vam = _mm_set1_ps(am), one = _mm_set1_ps(1);
+	__m128 acc_x[2] = {_mm_setzero_ps(), _mm_setzero_ps()};
+	__m128 acc_y[2] = {_mm_setzero_ps(), _mm_setzero_ps()};
+	size_t i = 0;
+	for (; i + LANES <= n; i += LANES)
+		for (int h = 0; h < 2; h++) {
+			const size_t o = i + 4*h;
+			const __m128 dx = _mm_sub_ps(vax, _mm_loadu_ps(px + o));
+			const __m128 dy = _mm_sub_ps(vay, _mm_loadu_ps(py + o));
+			const __m128 dist2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+			const __m128 k = _mm_div_ps(one, _mm_mul_ps(_mm_sqrt_ps(dist2), dist2));
+			const __m128 dxk = _mm_mul_ps(dx, k), dyk = _mm_mul_ps(dy, k);
+			const __m128 r = _mm_loadu_ps(radius + o);
+			const __m128 m = _mm_mul_ps(r, r);
+			_mm_storeu_ps(vx + o, _mm_add_ps(_mm_loadu_ps(vx + o), _mm_mul_ps(dxk, vam)));
+			_mm_storeu_ps(vy + o, _mm_add_ps(_mm_loadu_ps(vy + o), _mm_mul_ps(dyk, vam)));
+			acc_x[h] = _mm_add_ps(acc_x[h], _mm_mul_ps(dxk, m));
+			acc_y[h] = _mm_add_ps(acc_y[h], _mm_mul_ps(dyk, m));
+		}
+	float lx[LANES], ly[LANES];
+	_mm_storeu_ps(lx, acc_x[0]);
+	_mm_storeu_ps(lx + 4, acc_x[1]);
+	_mm_storeu_ps(ly, acc_y[0]);
+	_mm_storeu_ps(ly + 4, acc_y[1]);
+	PullRange(px, py, vx, vy, radius, i, n, ax, ay, am, lx, ly);
+	SumLanes(lx, ly, rx, ry);
+}
+
+__attribute__((target("sse2")))
+static void IntegrateSSE2(float* px, float* py, const float* vx, const float* vy, size_t n, float dt) {
+	const __m128 vdt = _mm_set1_ps(dt);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(_mm_loadu_ps(vx + i), vdt)));
+		_mm_storeu_ps(py + i, _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(_mm_loadu_ps(vy + i), vdt)));
+	}
+	IntegrateScalar(px + i, py + i, vx + i, vy + i, n - i, dt);
+}
+
+__attribute__((target("sse2")))
+static size_t FirstOverlapSSE2(float x, float y, float r, const float* cx, const float* cy, const float* cr,
+	size_t from, size_t n) {
+	const __m128 vx = _mm_set1_ps(x), vy = _mm_set1_ps(y), vr = _mm_set1_ps(r);
+	size_t k = from;
+	for (; k + 4 <= n; k += 4) {
+		const __m128 dx = _mm_sub_ps(vx, _mm_loadu_ps(cx + k));
+		const __m128 dy = _mm_sub_ps(vy, _mm_loadu_ps(cy + k));
+		const __m128 s = _mm_add_ps(vr, _mm_loadu_ps(cr + k));
+		const __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+		const int mask = _mm_movemask_ps(_mm_cmple_ps(d2, _mm_mul_ps(s, s)));
+		if (mask) return k + __builtin_ctz(mask);
+	}
+	return FirstOverlapScalar(x, y, r, cx, cy, cr, k, n);
+}
+
+
+// AVX2, one register per block of 8
+//FMA is left out on purpose, fused results would differ from the other versions
+
+__attribute__((target("avx2")))
+static void PullAVX2(const float* px, const float* py, float* vx, float* vy, const float* radius, size_t n,
+	float ax, float ay, float am, float& rx, float& ry) {
+	const __m256 vax = _mm256_set1_ps(ax), vay = _mm256_set1_ps(ay), vam = _mm256_set1_ps(am);
+	const __m256 one = _mm256_set1_ps(1);
+	__m256 acc_x = _mm256_setzero_ps(), acc_y = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + LANES <= n; i += LANES) {
+		const __m256 dx = _mm256_sub_ps(vax, _mm256_loadu_ps(px + i));
+		const __m256 dy = _mm256_sub_ps(vay, _mm256_loadu_ps(py + i));
+		const __m256 dist2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+		const __m256 k = _mm256_div_ps(one, _mm256_mul_ps(_mm256_sqrt_ps(dist2), dist2));
+		const __m256 dxk = _mm256_mul_ps(dx, k), dyk = _mm256_mul_ps(dy, k);
+		const __m256 r = _mm256_loadu_ps(radius + i);
+		const __m256 m = _mm256_mul_ps(r, r);
+		_mm256_storeu_ps(vx + i, _mm256_add_ps(_mm256_loadu_ps(vx + i), _mm256_mul_ps(dxk, vam)));
+		_mm256_storeu_ps(vy + i, _mm256_add_ps(_mm256_loadu_ps(vy + i), _mm256_mul_ps(dyk, vam)));
+		acc_x = _mm256_add_ps(acc_x, _mm256_mul_ps(dxk, m));
+		acc_y = _mm256_add_ps(acc_y, _mm256_mul_ps(dyk, m));
+	}
+	float lx[LANES], ly[LANES];
+	_mm256_storeu_ps(lx, acc_x);
+	_mm256_storeu_ps(ly, acc_y);
+	PullRange(px, py, vx, vy, radius, i, n, ax, ay, am, lx, ly);
+	SumLanes(lx, ly, rx, ry);
+}
+
+__attribute__((target("avx2")))
+static void IntegrateAVX2(float* px, float* py, const float* vx, const float* vy, size_t n, float dt) {
+	const __m256 vdt = _mm256_set1_ps(dt);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(px + i, _mm256_add_ps(_mm256_loadu_ps(px + i), _mm256_mul_ps(_mm256_loadu_ps(vx + i), vdt)));
+		_mm256_storeu_ps(py + i, _mm256_add_ps(_mm256_loadu_ps(py + i), _mm256_mul_ps(_mm256_loadu_ps(vy + i), vdt)));
+	}
+	IntegrateScalar(px + i, py + i, vx + i, vy + i, n - i, dt);
+}
+
+__attribute__((target("avx2")))
+static size_t FirstOverlapAVX2(float x, float y, float r, const float* cx, const float* cy, const float* cr,
+	size_t from, size_t n) {
+	const __m256 vx = _mm256_set1_ps(x), vy = _mm256_set1_ps(y), vr = _mm256_set1_ps(r);
+	size_t k = from;
+	for (; k + 8 <= n; k += 8) {
+		const __m256 dx = _mm256_sub_ps(vx, _mm256_loadu_ps(cx + k));
+		const __m256 dy = _mm256_sub_ps(vy, _mm256_loadu_ps(cy + k));
+		const __m256 s = _mm256_add_ps(vr, _mm256_loadu_ps(cr + k));
+		const __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+		const int mask = _mm256_movemask_ps(_mm256_cmp_ps(d2, _mm256_mul_ps(s, s), _CMP_LE_OQ));
+		if (mask) return k + __builtin_ctz(mask);
+	}
+	return FirstOverlapScalar(x, y, r, cx, cy, cr, k, n);
+}
+
+#endif
+
+
+// Dispatch
+
+struct simd_kernels {
+	simd_level level;
+	void (*pull)(const float*, const float*, float*, float*, const float*, size_t, float, float, float, float&, float&);
+	void (*integrate)(float*, float*, const float*, const float*, size_t, float);
+	size_t (*first_overlap)(float, float, float, const float*, const float*, const float*, size_t, size_t);
+};
+
+static simd_kernels KernelsFor(simd_level level) {
+#ifdef SIMD_X86
+	if (level == SIMD_AVX2) return {SIMD_AVX2, PullAVX2, IntegrateAVX2, FirstOverlapAVX2};
+	if (level == SIMD_SSE2) return {SIMD_SSE2, PullSSE2, IntegrateSSE2, FirstOverlapSSE2};
+#endif
+	return {SIMD_SCALAR, PullScalar, IntegrateScalar, FirstOverlapScalar};
+}
+
+static simd_kernels& Active(void) {
+	static simd_kernels k = KernelsFor(simd_detect());
+	return k;
+}
+
+simd_level simd_detect(void) {
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+#endif
+	return SIMD_SCALAR;
+}
+
+simd_level simd_active(void) {
+	return Active().level;
+}
+
+//not synchronized, only call it while no step is running
+simd_level simd_select(simd_level level) {
+	const simd_level best = simd_detect();
+	Active() = KernelsFor(level < best ? level : best);
+	return Active().level;
+}
+
+const char* simd_name(simd_level level) {
+	switch (level) {
+		case SIMD_AVX2: return "avx2";
+		case SIMD_SSE2: return "sse2";
+		default: return "scalar";
+	}
+}
+
+
+void simd_pull(const float* px, const float* py, float* vx, float* vy, const float* radius, size_t n,
+	float ax, float ay, float am, float& rx, float& ry) {
+	Active().pull(px, py, vx, vy, radius, n, ax, ay, am, rx, ry);
+}
+
+void simd_integrate(float* px, float* py, const float* vx, const float* vy, size_t n, float dt) {
+	Active().integrate(px, py, vx, vy, n, dt);
+}
+
+size_t simd_first_overlap(float x, float y, float r, const float* cx, const float* cy, const float* cr,
+	size_t from, size_t n) {
+	return Active().first_overlap(x, y, r, cx, cy, cr, from, n);
+}
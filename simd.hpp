@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+//Batch kernels over structure of arrays data.
+//The library carries scalar, SSE2 and AVX2 versions and picks the best one the CPU supports
+//on first use, so one binary runs on every x86 host. All versions do the same float operations
+//in the same order per lane (sums go into 8 fixed lanes), so results are bit identical
+//whichever version runs.
+
+enum simd_level {
+	SIMD_SCALAR,
+	SIMD_SSE2, //4 lanes
+	SIMD_AVX2, //8 lanes
+};
+
+//best level this CPU supports
+simd_level simd_detect(void);
+//level the kernels currently use
+simd_level simd_active(void);
+//switches the kernels to another level, clamped to what the CPU supports, returns the result
+simd_level simd_select(simd_level level);
+const char* simd_name(simd_level level);
+
+//pulls motes towards an attractor at (ax, ay) with strength am:
+//v[i] += d * am / |d|^3 where d = a - p[i], none of the motes may sit exactly on the attractor
+//the reaction sum of d * r[i]^2 / |d|^3 is added to (rx, ry)
+void simd_pull(const float* px, const float* py, float* vx, float* vy, const float* radius, size_t n,
+	float ax, float ay, float am, float& rx, float& ry);
+
+//p[i] += v[i] * dt
+void simd_integrate(float* px, float* py, const float* vx, const float* vy, size_t n, float dt);
+
+//circle (x, y, r) against packed candidates, same test as circle_circle_coll
+//returns the first candidate in [from, n) that overlaps, or n if none does
+size_t simd_first_overlap(float x, float y, float r, const float* cx, const float* cy, const float* cr,
+	size_t from, size_t n);
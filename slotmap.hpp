@@ -0,0 +1,164 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+//Generational handles.
+//A handle is a slot index plus the generation of the slot when it was handed out. Freeing a slot
+//bumps its generation, so every old handle to it stops resolving, and the next insert reuses it.
+//Lookups are a single array access and the arrays only grow to the most values alive at once.
+//Live slots have odd generations and free ones even, so the null handle (generation 0) and
+//handles to freed slots never match.
+
+struct Handle {
+	uint32_t index;
+	uint32_t generation;
+	
+	Handle(void) : index(0), generation(0) {}
+	Handle(uint32_t index, uint32_t generation) : index(index), generation(generation) {}
+	
+	bool IsNull(void) const { return generation == 0; }
+	bool operator==(const Handle& o) const { return index == o.index && generation == o.generation; }
+	bool operator!=(const Handle& o) const { return !(*this == o); }
+	//by slot, so sorted handles walk forward through the arrays they index
+	bool operator<(const Handle& o) const { return index < o.index || (index == o.index && generation < o.generation); }
+	bool operator>(const Handle& o) const { return o < *this; }
+};
+
+template <>
+struct std::hash<Handle> {
+	size_t operator()(const Handle& h) const { return (static_cast<uint64_t>(h.generation) << 32) | h.index; }
+};
+
+//memory of a pool of objects (motes, broad-phase ids), storage only grows so bytes stays flat
+//once the peak is reached and freed objects are reused from there
+struct pool_stats {
+	size_t live; //objects in use
+	size_t peak; //most objects in use at once
+	size_t bytes; //held in total
+	size_t used; //bytes holding live objects
+	
+	//share of the bytes held that no live object uses
+	double Fragmentation(void) const { return bytes > 0 ? 1 - static_cast<double>(used) / bytes : 0; }
+};
+
+//bytes a vector holds, whether used or not
+template <typename T>
+size_t VectorBytes(const std::vector<T>& v) { return v.capacity() * sizeof(T); }
+
+//owns the handles, every live one maps to a value
+template <typename T>
+class SlotMap {
+	std::vector<T> values;
+	std::vector<uint32_t> generation;
+	std::vector<uint32_t> free_slots; //reused last in, first out
+	size_t count;
+
+public:
+	SlotMap(void) : count(0) {}
+	
+	size_t size(void) const { return count; }
+	//amount of slots ever used, live or free
+	size_t capacity(void) const { return values.size(); }
+	void reserve(size_t n) { values.reserve(n), generation.reserve(n); }
+	void clear(void) { values.clear(), generation.clear(), free_slots.clear(), count = 0; }
+	size_t bytes(void) const { return VectorBytes(values) + VectorBytes(generation) + VectorBytes(free_slots); }
+	static constexpr size_t SLOT_BYTES = sizeof(T) + sizeof(uint32_t);
+	
+	Handle Insert(const T& v) {
+		count++;
+		if (!free_slots.empty()) {
+			const uint32_t s = free_slots.back();
+			free_slots.pop_back();
+			values[s] = v;
+			return Handle(s, ++generation[s]);
+		}
+		values.push_back(v);
+		generation.push_back(1);
+		return Handle(values.size() - 1, 1);
+	}
+	
+	//replaces every value with value_at(0 .. n-1) in slots 0 .. n-1 and writes their handles to out
+	//each slot's generation moves past all it handed out before, so no earlier handle resolves again
+	template <typename ValueAt>
+	void Refill(size_t n, ValueAt&& value_at, Handle* out) {
+		if (n > values.size()) values.resize(n), generation.resize(n, 0);
+		free_slots.clear();
+		for (size_t s = values.size(); s-- > 0;) {
+			uint32_t& g = generation[s];
+			if (s < n) {
+				g = (g | 1) + (g & 1 ? 2 : 0); //next odd one
+				values[s] = value_at(s);
+				out[s] = Handle(s, g);
+			} else {
+				g += g & 1; //live ones are freed
+				free_slots.push_back(s);
+			}
+		}
+		count = n;
+	}
+	
+	//false if the handle is stale
+	bool Remove(Handle h) {
+		if (!Contains(h)) return false;
+		generation[h.index]++;
+		free_slots.push_back(h.index);
+		count--;
+		return true;
+	}
+	
+	bool Contains(Handle h) const { return h.index < generation.size() && generation[h.index] == h.generation; }
+	T* Find(Handle h) { return Contains(h) ? &values[h.index] : nullptr; }
+	const T* Find(Handle h) const { return Contains(h) ? &values[h.index] : nullptr; }
+};
+
+//values attached to handles handed out by a SlotMap elsewhere, indexed by their slot
+//an entry left behind by a stale handle counts as missing and is replaced by the next TryEmplace()
+template <typename T>
+class HandleTable {
+	std::vector<T> values;
+	std::vector<uint32_t> generation; //of the handle stored in the slot, 0 if none
+	size_t count;
+
+public:
+	HandleTable(void) : count(0) {}
+	
+	size_t size(void) const { return count; }
+	void reserve(size_t n) { values.reserve(n), generation.reserve(n); }
+	void clear(void) { values.clear(), generation.clear(), count = 0; }
+	size_t bytes(void) const { return VectorBytes(values) + VectorBytes(generation); }
+	static constexpr size_t SLOT_BYTES = sizeof(T) + sizeof(uint32_t);
+	
+	T* Find(Handle h) {
+		return h.index < generation.size() && generation[h.index] == h.generation && !h.IsNull() ? &values[h.index] : nullptr;
+	}
+	const T* Find(Handle h) const { return const_cast<HandleTable*>(this)->Find(h); }
+	
+	//value of h and whether it was just added, new values are default constructed
+	std::pair<T*, bool> TryEmplace(Handle h) {
+		if (h.index >= values.size()) {
+			values.resize(h.index + 1);
+			generation.resize(h.index + 1, 0);
+		}
+		if (generation[h.index] == h.generation) return {&values[h.index], false};
+		if (generation[h.index] == 0) count++;
+		generation[h.index] = h.generation;
+		values[h.index] = T();
+		return {&values[h.index], true};
+	}
+	T& operator[](Handle h) { return *TryEmplace(h).first; }
+	//makes room for handles to the slots below n at once, instead of growing with every new slot
+	void grow(size_t n) {
+		if (n > values.size()) values.resize(n), generation.resize(n, 0);
+	}
+	
+	//false if h isn't stored
+	bool Erase(Handle h) {
+		if (Find(h) == nullptr) return false;
+		generation[h.index] = 0;
+		count--;
+		return true;
+	}
+};
@@ -0,0 +1,125 @@
+#include "snapshot.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#define SNAPSHOT_NO_MMAP
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(snapshot_header) == 72, "snapshot header layout changed");
+
+//columns are stored in host order, which has to match the file's
+static bool HostIsLittleEndian(void) {
+	const uint16_t v = 1;
+	uint8_t b;
+	memcpy(&b, &v, 1);
+	return b == 1;
+}
+
+static uint64_t ColumnBytes(snapshot_column c, uint64_t n) {
+	switch (c) {
+		case SNAP_TYPE: return n * sizeof(MoteType);
+		case SNAP_ID: return n * sizeof(uint64_t);
+		default: return n * sizeof(float);
+	}
+}
+
+uint64_t SnapshotOffset(snapshot_column c, uint64_t n) {
+	uint64_t offset = sizeof(snapshot_header);
+	for (int i = 0; i < c; i++)
+		offset = (offset + ColumnBytes(static_cast<snapshot_column>(i), n) + 7) & ~7ull;
+	return offset;
+}
+
+
+bool WriteSnapshot(const char* path, const snapshot_header& header, const MoteStore& motes) {
+	if (!HostIsLittleEndian() || header.motes != motes.size()) return false;
+	FILE* f = fopen(path, "wb");
+	if (f == nullptr) return false;
+	
+	const size_t n = motes.size();
+	const void* columns[SNAP_COLUMNS] = {
+		motes.px.data(), motes.py.data(), motes.vx.data(), motes.vy.data(), motes.radius.data(),
+		motes.time_offset.data(), motes.split_cooldown.data(), motes.type.data(), motes.id.data()
+	};
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	uint64_t at = sizeof(header);
+	for (int c = 0; c < SNAP_COLUMNS && ok; c++) {
+		const snapshot_column col = static_cast<snapshot_column>(c);
+		const uint64_t offset = SnapshotOffset(col, n);
+		static const uint8_t zero[8] = {};
+		ok = fwrite(zero, 1, offset - at, f) == offset - at; //padding
+		const uint64_t bytes = ColumnBytes(col, n);
+		ok = ok && (bytes == 0 || fwrite(columns[c], bytes, 1, f) == 1);
+		at = offset + bytes;
+	}
+	ok = fclose(f) == 0 && ok;
+	return ok;
+}
+
+
+bool Snapshot::Open(const char* path) {
+	Close();
+	if (!HostIsLittleEndian()) return false;
+
+#ifdef SNAPSHOT_NO_MMAP
+	FILE* f = fopen(path, "rb");
+	if (f == nullptr) return false;
+	fseek(f, 0, SEEK_END);
+	const long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t* buf = len > 0 ? static_cast<uint8_t*>(malloc(len)) : nullptr;
+	if (buf == nullptr || fread(buf, len, 1, f) != 1) {
+		free(buf);
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+	data = buf, size = len, mapped = false;
+#else
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return false;
+	}
+	void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); //the mapping keeps the file alive
+	if (p == MAP_FAILED) return false;
+	madvise(p, st.st_size, MADV_SEQUENTIAL);
+	data = static_cast<const uint8_t*>(p), size = st.st_size, mapped = true;
+#endif
+
+	//validate before anything reads the columns
+	const snapshot_header& h = Header();
+	const bool valid = size >= sizeof(snapshot_header)
+		&& memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) == 0
+		&& h.version == SNAPSHOT_VERSION
+		&& h.header_size == sizeof(snapshot_header)
+		&& h.motes < UINT32_MAX
+		&& SnapshotOffset(SNAP_COLUMNS, h.motes) <= size;
+	if (!valid) Close();
+	return valid;
+}
+
+void Snapshot::Close(void) {
+	if (data == nullptr) return;
+#ifdef SNAPSHOT_NO_MMAP
+	free(const_cast<uint8_t*>(data));
+#else
+	if (mapped) munmap(const_cast<uint8_t*>(data), size);
+#endif
+	data = nullptr, size = 0, mapped = false;
+}
+
+AABB Snapshot::Bounds(void) const {
+	const float* b = Header().bounds;
+	return AABB(b[0], b[1], b[2], b[3]);
+}
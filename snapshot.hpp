@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "collision.hpp"
+#include "motes.hpp"
+
+//Flat binary world snapshot, little-endian.
+//A header followed by one column per mote property, every column starts on an 8 byte boundary:
+//  px, py, vx, vy, radius, time_offset, split_cooldown (float), type (uint8), id (uint64)
+//Random numbers only depend on (seed, id, step), so the header's seed and step are the whole
+//RNG state. Positions before the last step are not stored.
+//The broad-phase is rebuilt on load, so collisions inside a crowded cell may be visited in another
+//order than in the run that saved it. Runs from the same snapshot are reproducible.
+
+constexpr char SNAPSHOT_MAGIC[8] = {'O','S','M','O','S','N','A','P'};
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size; //sizeof(snapshot_header) of the writer
+	uint64_t motes;
+	uint64_t next_id;
+	uint64_t seed;
+	uint64_t step;
+	float bounds[4]; //min x, min y, max x, max y
+	float total_area;
+	uint32_t flags; //reserved, 0
+};
+
+enum snapshot_column {
+	SNAP_PX, SNAP_PY, SNAP_VX, SNAP_VY, SNAP_RADIUS, SNAP_TIME_OFFSET, SNAP_SPLIT_COOLDOWN,
+	SNAP_TYPE, SNAP_ID,
+	SNAP_COLUMNS
+};
+
+//byte offset of a column in a snapshot of n motes, SNAP_COLUMNS gives the file size
+uint64_t SnapshotOffset(snapshot_column c, uint64_t n);
+
+//writes the header and every column of the store, false on any I/O error
+bool WriteSnapshot(const char* path, const snapshot_header& header, const MoteStore& motes);
+
+//read-only view of a snapshot file, the file is memory mapped while open
+class Snapshot {
+	const uint8_t* data;
+	size_t size;
+	bool mapped; //false if data is a heap copy (no mmap on this platform)
+
+public:
+	Snapshot(void) : data(nullptr), size(0), mapped(false) {}
+	Snapshot(const Snapshot&) = delete;
+	Snapshot& operator=(const Snapshot&) = delete;
+	~Snapshot() { Close(); }
+	
+	//maps the file and checks its header and size, false if it isn't a valid snapshot
+	bool Open(const char* path);
+	void Close(void);
+	bool IsOpen(void) const { return data != nullptr; }
+	
+	const snapshot_header& Header(void) const { return *reinterpret_cast<const snapshot_header*>(data); }
+	size_t Motes(void) const { return Header().motes; }
+	AABB Bounds(void) const;
+	
+	const float* Floats(snapshot_column c) const {
+		return reinterpret_cast<const float*>(data + SnapshotOffset(c, Motes()));
+	}
+	const MoteType* Types(void) const {
+		return reinterpret_cast<const MoteType*>(data + SnapshotOffset(SNAP_TYPE, Motes()));
+	}
+	const uint64_t* Ids(void) const {
+		return reinterpret_cast<const uint64_t*>(data + SnapshotOffset(SNAP_ID, Motes()));
+	}
+};
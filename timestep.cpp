@@ -0,0 +1,25 @@
+#include "timestep.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+int FixedTimestep::Advance(float sim_dt) {
+	accumulator += sim_dt;
+	int steps = static_cast<int>(accumulator / step);
+	
+	int cap = max_steps;
+	if (step_cost > 0) cap = std::min(cap, std::max(1, static_cast<int>(budget / step_cost)));
+	if (steps > cap) {
+		steps = cap;
+		accumulator = step * 0.999; //drop the rest but keep interpolating
+	} else {
+		accumulator -= steps * step;
+	}
+	return steps;
+}
+
+void FixedTimestep::Report(int steps, float wall_seconds) {
+	if (steps <= 0) return;
+	const float cost = wall_seconds / steps;
+	step_cost = step_cost > 0 ? step_cost * 0.9 + cost * 0.1 : cost;
+}
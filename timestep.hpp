@@ -0,0 +1,23 @@
+#pragma once
+
+
+//turns variable frame times into a whole amount of fixed size simulation steps
+struct FixedTimestep {
+	float step; //simulated seconds per step
+	int max_steps; //hard cap of steps per frame
+	float budget; //wall seconds per frame that may be spent simulating
+	float accumulator; //simulated time not yet stepped
+	float step_cost; //running average of wall seconds per step
+	
+	FixedTimestep(float step, int max_steps, float budget)
+	: step(step), max_steps(max_steps), budget(budget), accumulator(0), step_cost(0) {}
+	
+	//adds simulated time and returns how many steps to run now
+	//time that doesn't fit into the caps is dropped, so the simulation slows down instead of piling up
+	int Advance(float sim_dt);
+	//reports how long the last batch of steps took, used to respect the budget
+	void Report(int steps, float wall_seconds);
+	
+	//how far between the last two steps the current frame is, 0 -> 1
+	float Alpha(void) const { return accumulator / step; }
+};